@@ -0,0 +1,133 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+
+using std::string;
+
+// Outcome of one operation of a batch
+enum BatchStatus
+{
+    BATCH_OK,
+    BATCH_NO_SUCH_BOOK,
+    BATCH_NO_SUCH_READER,
+    BATCH_NOT_AVAILABLE,
+    BATCH_NOT_BORROWED,
+    BATCH_INVALID_VALUE,
+    BATCH_NOT_APPLIED       // skipped or rolled back because another operation of an all-or-nothing batch failed
+};
+
+// How a batch treats a failed operation
+enum BatchMode
+{
+    BATCH_ALL_OR_NOTHING,   // undo the operations before it and skip the rest
+    BATCH_EACH              // skip only that operation
+};
+
+// One circulation or edit step of a batch applied by Library::applyBatch.
+// Operations are plain values, built with the named constructors.
+class BatchOperation
+{
+    public:
+        enum Kind : uint8_t
+        {
+            BORROW,
+            RETURN,
+            EDIT_TITLE,
+            EDIT_AUTHOR,
+            EDIT_GENRE,
+            EDIT_YEAR,
+            EDIT_QUANTITY
+        };
+
+    private:
+        Kind kind;
+        string bookID;
+        string readerID;
+        string text;
+        int number = 0;
+
+        BatchOperation(Kind kind, const string &bookID): kind(kind), bookID(bookID) {};
+
+    public:
+        // A reader borrows a copy of a book
+        static BatchOperation borrow(const string &bookID, const string &readerID)
+        {
+            BatchOperation operation(BORROW, bookID);
+            operation.readerID = readerID;
+            return operation;
+        }
+
+        // A reader returns a copy of a book
+        static BatchOperation giveBack(const string &bookID, const string &readerID)
+        {
+            BatchOperation operation(RETURN, bookID);
+            operation.readerID = readerID;
+            return operation;
+        }
+
+        // Change a text field of a book (kind is EDIT_TITLE, EDIT_AUTHOR or EDIT_GENRE)
+        static BatchOperation edit(Kind kind, const string &bookID, const string &text)
+        {
+            BatchOperation operation(kind, bookID);
+            operation.text = text;
+            return operation;
+        }
+
+        // Change a number field of a book (kind is EDIT_YEAR or EDIT_QUANTITY)
+        static BatchOperation edit(Kind kind, const string &bookID, int number)
+        {
+            BatchOperation operation(kind, bookID);
+            operation.number = number;
+            return operation;
+        }
+
+        Kind getKind() const
+        {
+            return kind;
+        }
+
+        const string &getBookId() const
+        {
+            return bookID;
+        }
+
+        const string &getReaderId() const
+        {
+            return readerID;
+        }
+
+        const string &getText() const
+        {
+            return text;
+        }
+
+        int getNumber() const
+        {
+            return number;
+        }
+
+        // Short description of a status, for messages
+        static const char *statusText(BatchStatus status)
+        {
+            switch(status)
+            {
+                case BATCH_OK: return "OK";
+                case BATCH_NO_SUCH_BOOK: return "book ID not found";
+                case BATCH_NO_SUCH_READER: return "reader ID not found";
+                case BATCH_NOT_AVAILABLE: return "book is not available for borrowing";
+                case BATCH_NOT_BORROWED: return "reader has not borrowed the book";
+                case BATCH_INVALID_VALUE: return "invalid value";
+                case BATCH_NOT_APPLIED: return "not applied";
+            }
+            return "unknown";
+        }
+};
+
+// Outcome of a batch: a status for each operation, in order
+struct BatchReport
+{
+    std::vector<BatchStatus> results;
+    size_t applied = 0;
+    size_t failed = 0;
+};
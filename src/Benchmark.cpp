@@ -0,0 +1,204 @@
+#pragma once
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include "Library.cpp"
+#include "Parallel.cpp"
+
+using std::cout;
+using std::string;
+
+// Multi-threaded stress benchmark of a shared Library: threads borrow and return random books for random
+// readers, with some lookups mixed in, and throughput is measured at 1, 2, 4, ... threads up to the core count.
+// The library lives in memory only (no journal), so this measures the locking, not the disk.
+// Then bulk circulation is timed both ways, one call per operation and as batches, on a journaled library.
+class Benchmark
+{
+    private:
+        static const int BOOKS = 100000;
+        static const int READERS = 10000;
+        static const int SECONDS = 2;
+        static const int BULK_LOANS = 2000;
+
+        static string bookId(uint32_t number)
+        {
+            return "B" + std::to_string(number);
+        }
+
+        static string readerId(uint32_t number)
+        {
+            return "R" + std::to_string(number);
+        }
+
+        // Small fast random number generator, one per thread
+        static uint32_t nextRandom(uint64_t &state)
+        {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            return static_cast<uint32_t>(state >> 32);
+        }
+
+        // Run the operation mix on a number of threads for a while; returns operations per second
+        static double measure(Library &library, const std::vector<string> &bookIds, const std::vector<string> &readerIds, size_t threads)
+        {
+            std::atomic<bool> stop(false);
+            std::atomic<uint64_t> operations(0);
+            std::vector<std::thread> workers;
+
+            auto started = std::chrono::steady_clock::now();
+            for(size_t thread = 0; thread < threads; ++thread)
+            {
+                workers.push_back(std::thread([&, thread]
+                {
+                    uint64_t state = 0x9E3779B97F4A7C15ull * (thread + 1);
+                    uint64_t done = 0;
+
+                    while(!stop)
+                    {
+                        const string &book = bookIds[nextRandom(state) % bookIds.size()];
+                        const string &reader = readerIds[nextRandom(state) % readerIds.size()];
+                        uint32_t kind = nextRandom(state) % 10;
+
+                        // 80% circulation (a borrow and its return), 20% lookups
+                        if(kind < 8)
+                        {
+                            library.borrowBook(book, reader);
+                            library.returnBook(book, reader);
+                            done += 2;
+                        }
+                        else if(kind == 8)
+                        {
+                            library.isBorrowedBook(book);
+                            ++done;
+                        }
+                        else
+                        {
+                            library.getReaderBorrowedBook(reader);
+                            ++done;
+                        }
+                    }
+                    operations += done;
+                }));
+            }
+
+            std::this_thread::sleep_for(std::chrono::seconds(SECONDS));
+            stop = true;
+            for(auto &worker : workers)
+            {
+                worker.join();
+            }
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+            return operations / seconds;
+        }
+
+        // Fill a library with the benchmark's books and readers
+        static void populate(Library &library, std::vector<string> &bookIds, std::vector<string> &readerIds)
+        {
+            std::streambuf *output = cout.rdbuf(nullptr);
+            for(uint32_t i = 0; i < BOOKS; ++i)
+            {
+                bookIds.push_back(bookId(i));
+                library.appendBook(Book(bookIds.back(), "Title " + std::to_string(i), "Author " + std::to_string(i % 5000), "Genre " + std::to_string(i % 40), 1900 + i % 120, 1000, true));
+            }
+            for(uint32_t i = 0; i < READERS; ++i)
+            {
+                readerIds.push_back(readerId(i));
+                library.appendReader(Reader(readerIds.back(), "Reader " + std::to_string(i), {}));
+            }
+            cout.rdbuf(output);
+            cout.clear();
+        }
+
+        // Lend BULK_LOANS books and take them back, one call per operation and then as one batch of each,
+        // with every change journaled
+        static void measureBulk()
+        {
+            const char *journalFile = "benchmark-journal.txt";
+            std::vector<string> bookIds, readerIds;
+            std::vector<BatchOperation> loans, returns;
+            double single, batched;
+
+            {
+                // The books and readers are put in before the journal is opened: only the circulation is timed,
+                // and journaling 110000 appends one at a time would wait for as many syncs
+                Library library;
+                populate(library, bookIds, readerIds);
+                std::remove(journalFile);
+                library.openJournal(journalFile);
+                for(int i = 0; i < BULK_LOANS; ++i)
+                {
+                    loans.push_back(BatchOperation::borrow(bookIds[i * 7 % BOOKS], readerIds[i % READERS]));
+                    returns.push_back(BatchOperation::giveBack(bookIds[i * 7 % BOOKS], readerIds[i % READERS]));
+                }
+
+                auto started = std::chrono::steady_clock::now();
+                for(const auto &loan : loans)
+                {
+                    library.borrowBook(loan.getBookId(), loan.getReaderId());
+                }
+                for(const auto &loan : returns)
+                {
+                    library.returnBook(loan.getBookId(), loan.getReaderId());
+                }
+                single = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+
+                BatchReport report;
+                started = std::chrono::steady_clock::now();
+                library.applyBatch(loans, BATCH_ALL_OR_NOTHING, report);
+                library.applyBatch(returns, BATCH_ALL_OR_NOTHING, report);
+                batched = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+            }
+            std::remove(journalFile);
+
+            cout << "Bulk circulation, " << BULK_LOANS << " borrows and returns with a journal\n";
+            cout.precision(3);
+            cout << "  one call each: " << single << " s\n";
+            cout << "  as batches:    " << batched << " s (" << single / batched << "x faster)\n";
+        }
+
+    public:
+        static void run()
+        {
+            Library library;
+            std::vector<string> bookIds, readerIds;
+
+            cout << "Building a library of " << BOOKS << " books and " << READERS << " readers...\n";
+            populate(library, bookIds, readerIds);
+
+            size_t cores = Parallel::threadCount();
+            size_t most = (std::max)(cores, static_cast<size_t>(4));
+            double single = 0;
+
+            cout << "Borrow/return with lookups, " << SECONDS << " s per run, " << cores << " cores\n";
+            cout << "threads      ops/s   speedup\n";
+            for(size_t threads = 1; threads <= most; threads *= 2)
+            {
+                double rate = measure(library, bookIds, readerIds, threads);
+                if(threads == 1)
+                {
+                    single = rate;
+                }
+                cout.width(7);
+                cout << threads;
+                cout.width(11);
+                cout << static_cast<uint64_t>(rate);
+                cout.width(9);
+                cout << std::fixed;
+                cout.precision(2);
+                cout << rate / single << "x\n";
+            }
+
+            measureBulk();
+        }
+};
+
+const int Benchmark::BOOKS;
+const int Benchmark::READERS;
+const int Benchmark::SECONDS;
+const int Benchmark::BULK_LOANS;
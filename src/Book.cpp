@@ -58,22 +58,22 @@ class Book
             this->isAvailable = isAvailable;
         }
 
-        string getId() const
+        const string &getId() const
         {
             return bookID;
         }
 
-        string getTitle() const
+        const string &getTitle() const
         {
             return title;
         }
 
-        string getAuthor() const
+        const string &getAuthor() const
         {
             return author;
         }
 
-        string getGenre() const
+        const string &getGenre() const
         {
             return genre;
         }
@@ -0,0 +1,151 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <climits>
+
+using std::string;
+
+// A search over books built from field predicates combined with AND/OR.
+// Queries are plain values; Library plans and runs them against its indexes.
+class BookQuery
+{
+    public:
+        enum Kind
+        {
+            TITLE,
+            AUTHOR,
+            GENRE,
+            YEAR_RANGE,
+            AVAILABLE,
+            AND,
+            OR
+        };
+
+    private:
+        Kind kind;
+        string value;
+        int fromYear = INT_MIN;
+        int toYear = INT_MAX;
+        std::vector<BookQuery> children;
+
+        BookQuery(Kind kind): kind(kind) {};
+
+    public:
+        // Books with exactly this title
+        static BookQuery title(const string &title)
+        {
+            BookQuery query(TITLE);
+            query.value = title;
+            return query;
+        }
+
+        // Books with exactly this author
+        static BookQuery author(const string &author)
+        {
+            BookQuery query(AUTHOR);
+            query.value = author;
+            return query;
+        }
+
+        // Books with exactly this genre
+        static BookQuery genre(const string &genre)
+        {
+            BookQuery query(GENRE);
+            query.value = genre;
+            return query;
+        }
+
+        // Books published between two years (inclusive)
+        static BookQuery yearRange(int fromYear, int toYear)
+        {
+            BookQuery query(YEAR_RANGE);
+            query.fromYear = fromYear;
+            query.toYear = toYear;
+            return query;
+        }
+
+        // Books that can currently be borrowed
+        static BookQuery available()
+        {
+            return BookQuery(AVAILABLE);
+        }
+
+        // Books matching every sub-query (an empty list matches everything)
+        static BookQuery all(const std::vector<BookQuery> &queries)
+        {
+            BookQuery query(AND);
+            query.children = queries;
+            return query;
+        }
+
+        // Books matching at least one sub-query (an empty list matches nothing)
+        static BookQuery any(const std::vector<BookQuery> &queries)
+        {
+            BookQuery query(OR);
+            query.children = queries;
+            return query;
+        }
+
+        // Check a single book (a Book or anything with the same getters) against the query
+        template<typename Record>
+        bool matches(const Record &book) const
+        {
+            switch(kind)
+            {
+                case TITLE:
+                    return book.getTitle() == value;
+                case AUTHOR:
+                    return book.getAuthor() == value;
+                case GENRE:
+                    return book.getGenre() == value;
+                case YEAR_RANGE:
+                    return book.getYear() >= fromYear && book.getYear() <= toYear;
+                case AVAILABLE:
+                    return book.getIsAvailable();
+                case AND:
+                    for(const auto &child : children)
+                    {
+                        if(!child.matches(book))
+                        {
+                            return false;
+                        }
+                    }
+                    return true;
+                case OR:
+                    for(const auto &child : children)
+                    {
+                        if(child.matches(book))
+                        {
+                            return true;
+                        }
+                    }
+                    return false;
+            }
+            return false;
+        }
+
+        Kind getKind() const
+        {
+            return kind;
+        }
+
+        const string &getValue() const
+        {
+            return value;
+        }
+
+        int getFromYear() const
+        {
+            return fromYear;
+        }
+
+        int getToYear() const
+        {
+            return toYear;
+        }
+
+        const std::vector<BookQuery> &getChildren() const
+        {
+            return children;
+        }
+};
\ No newline at end of file
@@ -0,0 +1,592 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <atomic>
+#include "Book.cpp"
+#include "IdDictionary.cpp"
+#include "StringArena.cpp"
+#include "MappedFile.cpp"
+
+using std::string;
+
+// Number of copies of a book on the shelf. Borrowing takes a copy with a compare-and-swap that never goes below
+// zero, so many threads can check out the same title without a lock and without handing out more copies than
+// there are. Copying one (only done while the store is resized or rearranged, with no other thread using it)
+// copies its current value.
+class CopyCounter
+{
+    private:
+        std::atomic<int> count;
+
+    public:
+        CopyCounter(int copies = 0): count(copies) {};
+
+        CopyCounter(const CopyCounter &other): count(other.get()) {};
+
+        CopyCounter &operator=(const CopyCounter &other)
+        {
+            count.store(other.get(), std::memory_order_relaxed);
+            return *this;
+        }
+
+        int get() const
+        {
+            return count.load(std::memory_order_relaxed);
+        }
+
+        void set(int copies)
+        {
+            count.store(copies, std::memory_order_relaxed);
+        }
+
+        // Take one copy if there is any left
+        bool take()
+        {
+            int copies = count.load(std::memory_order_relaxed);
+
+            while(copies > 0)
+            {
+                if(count.compare_exchange_weak(copies, copies - 1, std::memory_order_acq_rel, std::memory_order_relaxed))
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // Put one copy back
+        void putBack()
+        {
+            count.fetch_add(1, std::memory_order_acq_rel);
+        }
+};
+
+// Column-oriented book storage: one array per field instead of one object per book.
+// Year and quantity sit in tight arrays and genres are dictionary-encoded as small integer codes,
+// so filters and aggregates over the whole catalog are simple loops the compiler can vectorize.
+// A book is available while it has copies on the shelf; quantities are atomic counters (see CopyCounter),
+// so circulation needs no lock on the store.
+// IDs, titles and authors live in a string arena owned by the store: no per-string heap allocation,
+// and dropping the store frees the catalog's text a block at a time. After a load they may instead point
+// straight into the mapped file, which the store then keeps open.
+// Rows are a slot map keyed by record handle: deleting moves the last row into the hole (O(1)),
+// and each handle carries a generation that changes on delete, so old references can tell they are stale.
+class BookStore
+{
+    public:
+        static const size_t NO_ROW = SIZE_MAX;
+
+    private:
+        static const size_t MIN_COMPACT_BYTES = 16 << 20;
+
+        std::vector<uint32_t> handles;
+        std::vector<StringRef> ids;
+        std::vector<StringRef> titles;
+        std::vector<StringRef> authors;
+        std::vector<uint32_t> genreCodes;
+        std::vector<int> years;
+        std::vector<CopyCounter> quantities;
+
+        // Genre dictionary and how many rows use each code
+        IdDictionary genres;
+        std::vector<size_t> genreCounts;
+
+        StringArena strings;
+        std::vector<std::shared_ptr<const MappedFile>> files;
+
+        // Handle -> current row (NO_ROW when the record is gone) and generation
+        std::vector<size_t> slotRows;
+        std::vector<uint32_t> slotGenerations;
+
+        // Remove one element from a column by moving the last element into its place
+        template<typename T>
+        static void swapRemove(std::vector<T> &column, size_t row)
+        {
+            column[row] = std::move(column.back());
+            column.pop_back();
+        }
+
+        // Whether a string points into one of the held files rather than the arena
+        bool inHeldFile(const StringRef &value) const
+        {
+            for(const auto &file : files)
+            {
+                if(value.data() >= file->data() && value.data() < file->data() + file->size())
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // Note that a string cell is no longer referenced; only arena strings count as waste,
+        // file-backed ones free nothing when compacted
+        void releaseString(const StringRef &cell)
+        {
+            if(!inHeldFile(cell))
+            {
+                strings.release(cell);
+            }
+        }
+
+        // Replace a string cell, copying the new value into the arena
+        void replaceString(StringRef &cell, const string &value)
+        {
+            releaseString(cell);
+            cell = strings.store(value);
+            compactIfWasteful();
+        }
+
+        // Copy the live strings into a fresh arena once edits and deletes have left it mostly garbage
+        void compactIfWasteful()
+        {
+            if(strings.wasted() < MIN_COMPACT_BYTES || strings.wasted() < strings.allocated() / 2)
+            {
+                return;
+            }
+            compact();
+        }
+
+        // Copy every live string, wherever it points, into a fresh arena
+        void compact()
+        {
+            StringArena compacted;
+            for(auto *column : {&ids, &titles, &authors})
+            {
+                for(auto &cell : *column)
+                {
+                    cell = compacted.store(cell.data(), cell.size());
+                }
+            }
+            strings.swap(compacted);
+        }
+
+        // Get or create the code of a genre and count one more row using it
+        uint32_t acquireGenre(const string &genre)
+        {
+            uint32_t code = genres.intern(genre);
+
+            if(code >= genreCounts.size())
+            {
+                genreCounts.resize(code + 1, 0);
+            }
+            ++genreCounts[code];
+            return code;
+        }
+
+    public:
+        BookStore(){};
+
+        size_t size() const
+        {
+            return ids.size();
+        }
+
+        bool empty() const
+        {
+            return ids.empty();
+        }
+
+        // Pre-size every column for an expected number of rows
+        void reserve(size_t count)
+        {
+            handles.reserve(count);
+            ids.reserve(count);
+            titles.reserve(count);
+            authors.reserve(count);
+            genreCodes.reserve(count);
+            years.reserve(count);
+            quantities.reserve(count);
+        }
+
+        // Keep a loaded file open for as long as rows may point into it
+        void holdFile(const std::shared_ptr<const MappedFile> &file)
+        {
+            files.push_back(file);
+        }
+
+        // Copy strings that point into held files into the arena and close the files
+        // (needed before a held file is overwritten)
+        void releaseFiles()
+        {
+            if(files.empty())
+            {
+                return;
+            }
+            compact();
+            files.clear();
+        }
+
+        // Append a row whose strings live in this store's arena or in a file it holds
+        void push(uint32_t handle, StringRef id, StringRef title, StringRef author, const string &genre, int year, int quantity)
+        {
+            if(handle >= slotRows.size())
+            {
+                slotRows.resize(handle + 1, NO_ROW);
+                slotGenerations.resize(handle + 1, 0);
+            }
+            slotRows[handle] = handles.size();
+
+            handles.push_back(handle);
+            ids.push_back(id);
+            titles.push_back(title);
+            authors.push_back(author);
+            genreCodes.push_back(acquireGenre(genre));
+            years.push_back(year);
+            quantities.push_back(CopyCounter(quantity));
+        }
+
+        // Append a book as a new row (its availability follows from its quantity)
+        void push(uint32_t handle, const Book &book)
+        {
+            push(handle, strings.store(book.getId()), strings.store(book.getTitle()), strings.store(book.getAuthor()),
+                 book.getGenre(), book.getYear(), book.getQuantity());
+        }
+
+        // Append a row, copying its strings into the arena
+        void pushCopy(uint32_t handle, StringRef id, StringRef title, StringRef author, const string &genre, int year, int quantity)
+        {
+            push(handle, strings.store(id.data(), id.size()), strings.store(title.data(), title.size()),
+                 strings.store(author.data(), author.size()), genre, year, quantity);
+        }
+
+        // Fill in the fields of a row pushed with only its ID (strings live in the arena or a held file)
+        void fill(size_t row, StringRef title, StringRef author, const string &genre, int year, int quantity)
+        {
+            titles[row] = title;
+            authors[row] = author;
+            setGenre(row, genre);
+            years[row] = year;
+            quantities[row].set(quantity);
+        }
+
+        // Clear every field of a row but its ID, so it can be filled in again later
+        void blank(size_t row)
+        {
+            releaseString(titles[row]);
+            releaseString(authors[row]);
+            fill(row, StringRef(), StringRef(), string(), 0, 0);
+        }
+
+        // Remove a row; the last row moves into its place
+        void erase(size_t row)
+        {
+            uint32_t handle = handles[row];
+
+            --genreCounts[genreCodes[row]];
+            releaseString(ids[row]);
+            releaseString(titles[row]);
+            releaseString(authors[row]);
+
+            slotRows[handles.back()] = row;
+            slotRows[handle] = NO_ROW;
+            ++slotGenerations[handle];
+
+            swapRemove(handles, row);
+            swapRemove(ids, row);
+            swapRemove(titles, row);
+            swapRemove(authors, row);
+            swapRemove(genreCodes, row);
+            swapRemove(years, row);
+            swapRemove(quantities, row);
+            compactIfWasteful();
+        }
+
+        // Current row of a handle, or NO_ROW if it has no record
+        size_t rowOf(uint32_t handle) const
+        {
+            if(handle >= slotRows.size())
+            {
+                return NO_ROW;
+            }
+            return slotRows[handle];
+        }
+
+        // Generation of a handle; it changes every time the handle's record is deleted
+        uint32_t generationOf(uint32_t handle) const
+        {
+            if(handle >= slotGenerations.size())
+            {
+                return 0;
+            }
+            return slotGenerations[handle];
+        }
+
+        // Copy a row out as a Book
+        Book get(size_t row) const
+        {
+            Book book;
+
+            book.setId(ids[row].str());
+            book.setTitle(titles[row].str());
+            book.setAuthor(authors[row].str());
+            book.setGenre(getGenre(row));
+            book.setYear(years[row]);
+            book.setQuantity(quantities[row].get());
+            book.setIsAvailable(quantities[row].get() > 0);
+            return book;
+        }
+
+        uint32_t getHandle(size_t row) const
+        {
+            return handles[row];
+        }
+
+        StringRef getId(size_t row) const
+        {
+            return ids[row];
+        }
+
+        StringRef getTitle(size_t row) const
+        {
+            return titles[row];
+        }
+
+        StringRef getAuthor(size_t row) const
+        {
+            return authors[row];
+        }
+
+        const string &getGenre(size_t row) const
+        {
+            return genres.name(genreCodes[row]);
+        }
+
+        uint32_t getGenreCode(size_t row) const
+        {
+            return genreCodes[row];
+        }
+
+        int getYear(size_t row) const
+        {
+            return years[row];
+        }
+
+        int getQuantity(size_t row) const
+        {
+            return quantities[row].get();
+        }
+
+        bool getIsAvailable(size_t row) const
+        {
+            return quantities[row].get() > 0;
+        }
+
+        void setTitle(size_t row, const string &title)
+        {
+            replaceString(titles[row], title);
+        }
+
+        void setAuthor(size_t row, const string &author)
+        {
+            replaceString(authors[row], author);
+        }
+
+        void setGenre(size_t row, const string &genre)
+        {
+            --genreCounts[genreCodes[row]];
+            genreCodes[row] = acquireGenre(genre);
+        }
+
+        void setYear(size_t row, int year)
+        {
+            years[row] = year;
+        }
+
+        void setQuantity(size_t row, int quantity)
+        {
+            quantities[row].set(quantity);
+        }
+
+        // Lend out one copy of a book; false if none is left. Safe to call from several threads at once.
+        bool takeCopy(size_t row)
+        {
+            return quantities[row].take();
+        }
+
+        // Put a lent copy back on the shelf. Safe to call from several threads at once.
+        void returnCopy(size_t row)
+        {
+            quantities[row].putBack();
+        }
+
+        // Get the code of a genre, or NO_HANDLE if no book ever had it
+        uint32_t findGenreCode(const string &genre) const
+        {
+            return genres.find(genre);
+        }
+
+        // Filters: AND a predicate into a per-row mask (1 = still selected)
+        void filterGenre(uint32_t code, std::vector<uint8_t> &mask) const
+        {
+            const uint32_t *column = genreCodes.data();
+            uint8_t *selected = mask.data();
+
+            for(size_t i = 0, n = genreCodes.size(); i < n; ++i)
+            {
+                selected[i] &= static_cast<uint8_t>(column[i] == code);
+            }
+        }
+
+        void filterYearRange(int fromYear, int toYear, std::vector<uint8_t> &mask) const
+        {
+            const int *column = years.data();
+            uint8_t *selected = mask.data();
+
+            for(size_t i = 0, n = years.size(); i < n; ++i)
+            {
+                selected[i] &= static_cast<uint8_t>((column[i] >= fromYear) & (column[i] <= toYear));
+            }
+        }
+
+        void filterAvailable(std::vector<uint8_t> &mask) const
+        {
+            const CopyCounter *column = quantities.data();
+            uint8_t *selected = mask.data();
+
+            for(size_t i = 0, n = quantities.size(); i < n; ++i)
+            {
+                selected[i] &= static_cast<uint8_t>(column[i].get() > 0);
+            }
+        }
+
+        // Aggregates
+        size_t countAvailable() const
+        {
+            size_t count = 0;
+
+            for(const auto &quantity : quantities)
+            {
+                count += quantity.get() > 0;
+            }
+            return count;
+        }
+
+        long long totalQuantity() const
+        {
+            long long total = 0;
+
+            for(const auto &quantity : quantities)
+            {
+                total += quantity.get();
+            }
+            return total;
+        }
+
+        // Longest genre name still in use (read from the dictionary, not from every row)
+        size_t maxGenreLength() const
+        {
+            size_t longest = 0;
+
+            for(uint32_t code = 0; code < genreCounts.size(); ++code)
+            {
+                if(genreCounts[code] > 0)
+                {
+                    longest = (std::max)(longest, genres.name(code).length());
+                }
+            }
+            return longest;
+        }
+
+        // Longest value of a string column
+        static size_t maxLength(const std::vector<StringRef> &column)
+        {
+            size_t longest = 0;
+
+            for(const auto &value : column)
+            {
+                longest = (std::max)(longest, value.length());
+            }
+            return longest;
+        }
+
+        size_t maxIdLength() const
+        {
+            return maxLength(ids);
+        }
+
+        size_t maxTitleLength() const
+        {
+            return maxLength(titles);
+        }
+
+        size_t maxAuthorLength() const
+        {
+            return maxLength(authors);
+        }
+};
+
+// Read-only reference to one book of a BookStore, with the same getters as Book.
+// It follows its book across other books' deletes; once its own book is deleted it becomes stale
+// (isValid() returns false) and must not be read. It reads the store directly, so it is only used while the
+// store cannot change (under the library's catalog lock); lookups hand out Book copies instead.
+class BookRef
+{
+    private:
+        const BookStore *store;
+        uint32_t handle;
+        uint32_t generation;
+
+        size_t row() const
+        {
+            return store->rowOf(handle);
+        }
+
+    public:
+        BookRef(const BookStore *store, size_t row): store(store), handle(store->getHandle(row)), generation(store->generationOf(handle)) {};
+
+        // Check that the referenced book still exists
+        bool isValid() const
+        {
+            return store->rowOf(handle) != BookStore::NO_ROW && store->generationOf(handle) == generation;
+        }
+
+        uint32_t getHandle() const
+        {
+            return handle;
+        }
+
+        size_t getRow() const
+        {
+            return row();
+        }
+
+        StringRef getId() const
+        {
+            return store->getId(row());
+        }
+
+        StringRef getTitle() const
+        {
+            return store->getTitle(row());
+        }
+
+        StringRef getAuthor() const
+        {
+            return store->getAuthor(row());
+        }
+
+        const string &getGenre() const
+        {
+            return store->getGenre(row());
+        }
+
+        int getYear() const
+        {
+            return store->getYear(row());
+        }
+
+        int getQuantity() const
+        {
+            return store->getQuantity(row());
+        }
+
+        bool getIsAvailable() const
+        {
+            return store->getIsAvailable(row());
+        }
+};
+
+const size_t BookStore::NO_ROW;
@@ -0,0 +1,88 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+// CRC-32 (IEEE, as used by zip and PNG), computed eight bytes at a time ("slicing-by-8").
+// Used to detect torn or corrupted records in saved files and the journal.
+class Checksum
+{
+    private:
+        uint32_t state = 0xFFFFFFFF;
+
+        struct Tables
+        {
+            uint32_t table[8][256];
+
+            Tables()
+            {
+                for(uint32_t i = 0; i < 256; ++i)
+                {
+                    uint32_t crc = i;
+                    for(int bit = 0; bit < 8; ++bit)
+                    {
+                        crc = (crc >> 1) ^ (0xEDB88320 & (~(crc & 1) + 1));
+                    }
+                    table[0][i] = crc;
+                }
+                for(uint32_t i = 0; i < 256; ++i)
+                {
+                    for(int slice = 1; slice < 8; ++slice)
+                    {
+                        table[slice][i] = (table[slice - 1][i] >> 8) ^ table[0][table[slice - 1][i] & 0xFF];
+                    }
+                }
+            }
+        };
+
+        // Built once, on first use (thread-safe function-local static)
+        static const Tables &tables()
+        {
+            static const Tables instance;
+            return instance;
+        }
+
+    public:
+        Checksum(){};
+
+        // Feed more bytes
+        void update(const char *data, size_t size)
+        {
+            const uint32_t (&table)[8][256] = tables().table;
+            const unsigned char *bytes = reinterpret_cast<const unsigned char*>(data);
+            uint32_t crc = state;
+
+            while(size >= 8)
+            {
+                uint32_t low, high;
+                std::memcpy(&low, bytes, 4);
+                std::memcpy(&high, bytes + 4, 4);
+                low ^= crc;
+
+                // Little-endian byte order, as on every platform this builds for
+                crc = table[7][low & 0xFF] ^ table[6][(low >> 8) & 0xFF] ^ table[5][(low >> 16) & 0xFF] ^ table[4][low >> 24] ^
+                      table[3][high & 0xFF] ^ table[2][(high >> 8) & 0xFF] ^ table[1][(high >> 16) & 0xFF] ^ table[0][high >> 24];
+                bytes += 8;
+                size -= 8;
+            }
+            while(size-- > 0)
+            {
+                crc = (crc >> 8) ^ table[0][(crc ^ *bytes++) & 0xFF];
+            }
+            state = crc;
+        }
+
+        // CRC of everything fed so far
+        uint32_t value() const
+        {
+            return state ^ 0xFFFFFFFF;
+        }
+
+        // CRC of one buffer
+        static uint32_t of(const char *data, size_t size)
+        {
+            Checksum checksum;
+            checksum.update(data, size);
+            return checksum.value();
+        }
+};
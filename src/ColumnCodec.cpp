@@ -0,0 +1,204 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <climits>
+#include "FileWriter.cpp"
+#include "MappedFile.cpp"
+#include "IdDictionary.cpp"
+
+using std::string;
+
+// Column encodings used inside file segments. A segment stores one column after another, each covering every
+// record of the segment:
+//  - integers are LEB128 varints, signed ones zigzag-coded first so small negative values stay short,
+//  - a string column is the varint lengths of all values followed by all their bytes, so strings can be used in place,
+//  - a dictionary column stores each distinct string once, then a varint code per record,
+//  - a flag column packs eight records per byte.
+// Varints are byte-oriented, so the encoded columns do not depend on the machine's byte order or int size.
+class ColumnCodec
+{
+    public:
+        static void writeVarint(ByteWriter &out, uint64_t value)
+        {
+            char bytes[10];
+            size_t size = 0;
+
+            while(value >= 0x80)
+            {
+                bytes[size++] = static_cast<char>((value & 0x7F) | 0x80);
+                value >>= 7;
+            }
+            bytes[size++] = static_cast<char>(value);
+            out.write(bytes, size);
+        }
+
+        static bool readVarint(ByteReader &in, uint64_t &value)
+        {
+            value = 0;
+            for(int shift = 0; shift < 64; shift += 7)
+            {
+                uint8_t byte;
+                if(!in.read(byte))
+                {
+                    return false;
+                }
+                value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+                if(!(byte & 0x80))
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // Column of count ints from get(i)
+        template<typename Get>
+        static void writeInts(ByteWriter &out, size_t count, Get get)
+        {
+            for(size_t i = 0; i < count; ++i)
+            {
+                int64_t value = get(i);
+                writeVarint(out, (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+            }
+        }
+
+        static bool readInts(ByteReader &in, size_t count, std::vector<int> &values)
+        {
+            values.resize(count);
+            for(auto &value : values)
+            {
+                uint64_t raw;
+                if(!readVarint(in, raw))
+                {
+                    return false;
+                }
+
+                int64_t decoded = static_cast<int64_t>(raw >> 1) ^ -static_cast<int64_t>(raw & 1);
+                if(decoded < INT_MIN || decoded > INT_MAX)
+                {
+                    return false;
+                }
+                value = static_cast<int>(decoded);
+            }
+            return true;
+        }
+
+        // Column of count strings (anything with data() and size()) from get(i)
+        template<typename Get>
+        static void writeStrings(ByteWriter &out, size_t count, Get get)
+        {
+            for(size_t i = 0; i < count; ++i)
+            {
+                writeVarint(out, get(i).size());
+            }
+            for(size_t i = 0; i < count; ++i)
+            {
+                const auto &value = get(i);
+                out.write(value.data(), value.size());
+            }
+        }
+
+        // Read a string column; the values point into the reader's buffer
+        static bool readStrings(ByteReader &in, size_t count, std::vector<StringRef> &values)
+        {
+            std::vector<uint64_t> lengths(count);
+
+            for(auto &length : lengths)
+            {
+                if(!readVarint(in, length))
+                {
+                    return false;
+                }
+            }
+
+            values.resize(count);
+            for(size_t i = 0; i < count; ++i)
+            {
+                if(lengths[i] > in.remaining() || !in.take(static_cast<size_t>(lengths[i]), values[i]))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // Dictionary column of count strings from get(i)
+        template<typename Get>
+        static void writeDictionary(ByteWriter &out, size_t count, Get get)
+        {
+            IdDictionary dictionary;
+            std::vector<uint32_t> codes(count);
+
+            for(size_t i = 0; i < count; ++i)
+            {
+                codes[i] = dictionary.intern(get(i));
+            }
+
+            writeVarint(out, dictionary.size());
+            writeStrings(out, dictionary.size(), [&dictionary](size_t code) -> const string &
+            {
+                return dictionary.name(static_cast<uint32_t>(code));
+            });
+            for(uint32_t code : codes)
+            {
+                writeVarint(out, code);
+            }
+        }
+
+        // Read a dictionary column as its distinct values plus a code per record
+        static bool readDictionary(ByteReader &in, size_t count, std::vector<StringRef> &dictionary, std::vector<uint32_t> &codes)
+        {
+            uint64_t dictionarySize;
+
+            if(!readVarint(in, dictionarySize) || dictionarySize > in.remaining() ||
+               !readStrings(in, static_cast<size_t>(dictionarySize), dictionary))
+            {
+                return false;
+            }
+
+            codes.resize(count);
+            for(auto &code : codes)
+            {
+                uint64_t value;
+                if(!readVarint(in, value) || value >= dictionarySize)
+                {
+                    return false;
+                }
+                code = static_cast<uint32_t>(value);
+            }
+            return true;
+        }
+
+        // Column of count flags from get(i), eight to a byte
+        template<typename Get>
+        static void writeFlags(ByteWriter &out, size_t count, Get get)
+        {
+            for(size_t i = 0; i < count; i += 8)
+            {
+                uint8_t byte = 0;
+                for(size_t bit = 0; bit < 8 && i + bit < count; ++bit)
+                {
+                    byte |= static_cast<uint8_t>(get(i + bit) ? 1 : 0) << bit;
+                }
+                out.write(byte);
+            }
+        }
+
+        static bool readFlags(ByteReader &in, size_t count, std::vector<uint8_t> &flags)
+        {
+            StringRef bytes;
+
+            if(!in.take((count + 7) / 8, bytes))
+            {
+                return false;
+            }
+
+            flags.resize(count);
+            for(size_t i = 0; i < count; ++i)
+            {
+                flags[i] = (static_cast<uint8_t>(bytes.data()[i / 8]) >> (i % 8)) & 1;
+            }
+            return true;
+        }
+};
@@ -0,0 +1,723 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstring>
+#include <cstdint>
+#include <cctype>
+#include <algorithm>
+#include "StringArena.cpp"
+
+using std::string;
+
+// One record of a feed: the value of each requested field, whether the record had it at all, and what was wrong
+// with it if it could not be parsed
+struct FeedRecord
+{
+    std::vector<string> values;
+    std::vector<uint8_t> present;
+    string problem;
+};
+
+// Outcome of a bulk import
+struct ImportReport
+{
+    static const size_t MAX_PROBLEMS = 20;
+
+    uint64_t rows = 0;                  // records read from the feed
+    uint64_t imported = 0;
+    uint64_t rejected = 0;
+    uint64_t bytes = 0;                 // size of the feed read
+    double seconds = 0;
+    std::vector<string> problems;       // why rows were rejected, for the first MAX_PROBLEMS of them
+};
+
+// Reads a CSV or JSON Lines feed one record at a time through a fixed-size buffer, so a feed of any size
+// is parsed in bounded memory (the buffer only grows for a single record larger than it, and a record longer
+// than MAX_RECORD_SIZE is rejected and skipped).
+//  - CSV: the first line names the columns, in any order; values may be quoted, with "" for a quote inside.
+//  - JSON Lines: one flat object per line; values are strings, numbers, true/false or null (= missing).
+// Only the requested fields are kept; other columns and keys are skipped.
+class FeedReader
+{
+    public:
+        enum Format
+        {
+            CSV,
+            JSON_LINES
+        };
+
+        static const size_t MAX_RECORD_SIZE = 1 << 24;
+
+    private:
+        static const size_t CHUNK_SIZE = 1 << 20;
+
+        // Where the record scan is in CSV syntax, following splitCsv: quotes only open a value at its start,
+        // and inside a quoted value "" is a quote
+        enum ScanState
+        {
+            FIELD_START,
+            UNQUOTED,
+            QUOTED,
+            QUOTE_IN_QUOTED     // a quote inside a quoted value: its end, or the first half of ""
+        };
+
+        std::ifstream input;
+        Format format = CSV;
+        std::vector<string> fieldNames;
+        size_t requiredFields = 0;
+        std::vector<size_t> columnFields;   // CSV column -> requested field, or NO_FIELD
+        std::vector<char> buffer;
+        size_t begin = 0;
+        size_t end = 0;
+        bool atEnd = false;
+        uint64_t nextLine = 1;
+        uint64_t recordLine = 0;
+        uint64_t consumed = 0;
+        string failure;
+        size_t scanned = 0;                 // bytes of the current record scanned so far
+        ScanState scanState = FIELD_START;
+        bool oversized = false;             // the last record was longer than MAX_RECORD_SIZE
+
+        static const size_t NO_FIELD = SIZE_MAX;
+
+        // Read more of the file after the unread bytes; false once there is nothing more
+        bool fill()
+        {
+            if(atEnd)
+            {
+                return false;
+            }
+            if(begin > 0)
+            {
+                std::memmove(buffer.data(), buffer.data() + begin, end - begin);
+                end -= begin;
+                begin = 0;
+            }
+            if(end == buffer.size())
+            {
+                buffer.resize(buffer.size() * 2);
+            }
+
+            input.read(buffer.data() + end, static_cast<std::streamsize>(buffer.size() - end));
+            size_t got = static_cast<size_t>(input.gcount());
+            if(got == 0)
+            {
+                atEnd = true;
+                if(input.bad())
+                {
+                    failure = "Failed to read feed file.";
+                }
+                return false;
+            }
+            end += got;
+            return true;
+        }
+
+        // Find the end of the record starting at begin: the first newline not inside a quoted CSV value.
+        // Scanning picks up where the last call stopped, so a long record is scanned once however often the
+        // buffer is refilled.
+        size_t findRecordEnd()
+        {
+            size_t from = begin + scanned;
+            scanned = end - begin;
+
+            if(format == JSON_LINES)
+            {
+                const void *newline = std::memchr(buffer.data() + from, '\n', end - from);
+                return newline ? static_cast<const char*>(newline) - buffer.data() : end;
+            }
+
+            for(size_t i = from; i < end; ++i)
+            {
+                char character = buffer[i];
+                switch(scanState)
+                {
+                    case FIELD_START:
+                    case UNQUOTED:
+                        if(character == '"' && scanState == FIELD_START)
+                        {
+                            scanState = QUOTED;
+                            break;
+                        }
+                        if(character == '\n')
+                        {
+                            return i;
+                        }
+                        scanState = character == ',' ? FIELD_START : UNQUOTED;
+                        break;
+                    case QUOTED:
+                        if(character == '"')
+                        {
+                            scanState = QUOTE_IN_QUOTED;
+                        }
+                        break;
+                    case QUOTE_IN_QUOTED:
+                        // Anything but a second quote, a comma or the line end is malformed; splitCsv rejects it
+                        if(character == '\n')
+                        {
+                            return i;
+                        }
+                        scanState = character == '"' ? QUOTED : (character == ',' ? FIELD_START : UNQUOTED);
+                        break;
+                }
+            }
+            return end;
+        }
+
+        // Drop the rest of an oversized record, up to and including the next line break
+        void skipRecord()
+        {
+            for(;;)
+            {
+                const void *newline = std::memchr(buffer.data() + begin, '\n', end - begin);
+                size_t stop = newline ? static_cast<const char*>(newline) - buffer.data() + 1 : end;
+
+                nextLine += std::count(buffer.data() + begin, buffer.data() + stop, '\n');
+                consumed += stop - begin;
+                begin = stop;
+                if(newline || !fill())
+                {
+                    return;
+                }
+            }
+        }
+
+        // Take the text of the next record out of the buffer; false at the end of the feed.
+        // A record longer than MAX_RECORD_SIZE is skipped and comes back empty, with oversized set.
+        bool nextText(StringRef &text)
+        {
+            scanned = 0;
+            scanState = FIELD_START;
+            oversized = false;
+            recordLine = nextLine;
+
+            size_t recordEnd = findRecordEnd();
+            while(recordEnd == end)
+            {
+                if(end - begin >= MAX_RECORD_SIZE)
+                {
+                    oversized = true;
+                    skipRecord();
+                    text = StringRef();
+                    return true;
+                }
+                // Refilling moves the unread bytes to the start of the buffer
+                if(!fill())
+                {
+                    recordEnd = end;
+                    break;
+                }
+                recordEnd = findRecordEnd();
+            }
+            if(begin == end)
+            {
+                return false;
+            }
+
+            size_t next = recordEnd < end ? recordEnd + 1 : end;
+            size_t length = recordEnd - begin;
+            if(length > 0 && buffer[begin + length - 1] == '\r')
+            {
+                --length;
+            }
+            text = StringRef(buffer.data() + begin, length);
+
+            nextLine += std::count(buffer.data() + begin, buffer.data() + recordEnd, '\n') + (recordEnd < end ? 1 : 0);
+            consumed += next - begin;
+            begin = next;
+            return true;
+        }
+
+        static bool isBlank(StringRef text)
+        {
+            for(size_t i = 0; i < text.size(); ++i)
+            {
+                if(!std::isspace(static_cast<unsigned char>(text.data()[i])))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        static string lowered(const string &text)
+        {
+            string result = text;
+            for(auto &character : result)
+            {
+                character = static_cast<char>(std::tolower(static_cast<unsigned char>(character)));
+            }
+            return result;
+        }
+
+        static string trimmed(const string &text)
+        {
+            size_t first = text.find_first_not_of(" \t");
+            size_t last = text.find_last_not_of(" \t");
+
+            return first == string::npos ? string() : text.substr(first, last - first + 1);
+        }
+
+        // Split a CSV record into its values, calling value(column, text) for each
+        template<typename F>
+        static bool splitCsv(StringRef text, string &scratch, F value)
+        {
+            const char *position = text.data();
+            const char *last = text.data() + text.size();
+
+            for(size_t column = 0; ; ++column)
+            {
+                scratch.clear();
+                if(position < last && *position == '"')
+                {
+                    for(++position; ; ++position)
+                    {
+                        if(position == last)
+                        {
+                            return false;
+                        }
+                        if(*position == '"')
+                        {
+                            if(position + 1 < last && position[1] == '"')
+                            {
+                                ++position;
+                            }
+                            else
+                            {
+                                ++position;
+                                break;
+                            }
+                        }
+                        scratch += *position;
+                    }
+                    if(position < last && *position != ',')
+                    {
+                        return false;
+                    }
+                }
+                else
+                {
+                    const char *comma = static_cast<const char*>(std::memchr(position, ',', last - position));
+                    const char *valueEnd = comma ? comma : last;
+                    scratch.assign(position, valueEnd);
+                    position = valueEnd;
+                }
+
+                value(column, scratch);
+                if(position == last)
+                {
+                    return true;
+                }
+                ++position;
+            }
+        }
+
+        bool readHeader()
+        {
+            StringRef text;
+            string scratch;
+
+            if(!nextText(text))
+            {
+                failure = failure.empty() ? "The feed is empty." : failure;
+                return false;
+            }
+            if(oversized)
+            {
+                failure = "The CSV header line is too long.";
+                return false;
+            }
+            // Skip a UTF-8 byte order mark
+            if(text.size() >= 3 && std::memcmp(text.data(), "\xEF\xBB\xBF", 3) == 0)
+            {
+                text = StringRef(text.data() + 3, text.size() - 3);
+            }
+
+            std::vector<uint8_t> found(fieldNames.size(), 0);
+            bool valid = splitCsv(text, scratch, [this, &found](size_t column, const string &name)
+            {
+                string key = lowered(trimmed(name));
+                columnFields.push_back(NO_FIELD);
+                for(size_t field = 0; field < fieldNames.size(); ++field)
+                {
+                    if(fieldNames[field] == key && !found[field])
+                    {
+                        columnFields[column] = field;
+                        found[field] = 1;
+                    }
+                }
+            });
+            if(!valid)
+            {
+                failure = "The CSV header line is malformed.";
+                return false;
+            }
+
+            for(size_t field = 0; field < requiredFields; ++field)
+            {
+                if(!found[field])
+                {
+                    failure = "The CSV header has no \"" + fieldNames[field] + "\" column.";
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        void parseCsv(StringRef text, FeedRecord &record)
+        {
+            string scratch;
+            size_t columns = 0;
+
+            bool valid = splitCsv(text, scratch, [this, &record, &columns](size_t column, string &value)
+            {
+                columns = column + 1;
+                if(column < columnFields.size() && columnFields[column] != NO_FIELD)
+                {
+                    record.values[columnFields[column]].swap(value);
+                    record.present[columnFields[column]] = 1;
+                }
+            });
+            if(!valid)
+            {
+                record.problem = "malformed quoted value";
+            }
+            else if(columns != columnFields.size())
+            {
+                record.problem = "expected " + std::to_string(columnFields.size()) + " values, found " + std::to_string(columns);
+            }
+        }
+
+        static void skipSpace(const char *&position, const char *last)
+        {
+            while(position < last && std::isspace(static_cast<unsigned char>(*position)))
+            {
+                ++position;
+            }
+        }
+
+        static void appendUtf8(string &text, uint32_t code)
+        {
+            if(code < 0x80)
+            {
+                text += static_cast<char>(code);
+            }
+            else if(code < 0x800)
+            {
+                text += static_cast<char>(0xC0 | (code >> 6));
+                text += static_cast<char>(0x80 | (code & 0x3F));
+            }
+            else if(code < 0x10000)
+            {
+                text += static_cast<char>(0xE0 | (code >> 12));
+                text += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+                text += static_cast<char>(0x80 | (code & 0x3F));
+            }
+            else
+            {
+                text += static_cast<char>(0xF0 | (code >> 18));
+                text += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+                text += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+                text += static_cast<char>(0x80 | (code & 0x3F));
+            }
+        }
+
+        static bool readHex4(const char *&position, const char *last, uint32_t &code)
+        {
+            code = 0;
+            for(int i = 0; i < 4; ++i, ++position)
+            {
+                if(position == last || !std::isxdigit(static_cast<unsigned char>(*position)))
+                {
+                    return false;
+                }
+                char digit = static_cast<char>(std::tolower(static_cast<unsigned char>(*position)));
+                code = code * 16 + (digit <= '9' ? digit - '0' : digit - 'a' + 10);
+            }
+            return true;
+        }
+
+        // Read a JSON string starting at its opening quote, unescaping it into text
+        static bool readJsonString(const char *&position, const char *last, string &text)
+        {
+            text.clear();
+            for(++position; position < last; )
+            {
+                const char *special = position;
+                while(special < last && *special != '"' && *special != '\\')
+                {
+                    ++special;
+                }
+                text.append(position, special);
+                position = special;
+                if(position == last)
+                {
+                    return false;
+                }
+                if(*position++ == '"')
+                {
+                    return true;
+                }
+                if(position == last)
+                {
+                    return false;
+                }
+
+                char escape = *position++;
+                uint32_t code;
+                switch(escape)
+                {
+                    case '"': case '\\': case '/': text += escape; break;
+                    case 'b': text += '\b'; break;
+                    case 'f': text += '\f'; break;
+                    case 'n': text += '\n'; break;
+                    case 'r': text += '\r'; break;
+                    case 't': text += '\t'; break;
+                    case 'u':
+                        if(!readHex4(position, last, code))
+                        {
+                            return false;
+                        }
+                        // A surrogate pair encodes one character beyond the basic plane
+                        if(code >= 0xD800 && code < 0xDC00 && last - position >= 6 && position[0] == '\\' && position[1] == 'u')
+                        {
+                            const char *low = position + 2;
+                            uint32_t second;
+                            if(readHex4(low, last, second) && second >= 0xDC00 && second < 0xE000)
+                            {
+                                code = 0x10000 + ((code - 0xD800) << 10) + (second - 0xDC00);
+                                position = low;
+                            }
+                        }
+                        appendUtf8(text, code);
+                        break;
+                    default:
+                        return false;
+                }
+            }
+            return false;
+        }
+
+        void parseJson(StringRef text, FeedRecord &record)
+        {
+            const char *position = text.data();
+            const char *last = text.data() + text.size();
+            string key, value;
+
+            skipSpace(position, last);
+            if(position == last || *position != '{')
+            {
+                record.problem = "not a JSON object";
+                return;
+            }
+            ++position;
+            skipSpace(position, last);
+            if(position < last && *position == '}')
+            {
+                ++position;
+            }
+            else
+            {
+                while(true)
+                {
+                    skipSpace(position, last);
+                    if(position == last || *position != '"' || !readJsonString(position, last, key))
+                    {
+                        record.problem = "malformed key";
+                        return;
+                    }
+                    skipSpace(position, last);
+                    if(position == last || *position != ':')
+                    {
+                        record.problem = "missing ':' after \"" + key + "\"";
+                        return;
+                    }
+                    ++position;
+                    skipSpace(position, last);
+
+                    bool isNull = false;
+                    if(position < last && *position == '"')
+                    {
+                        if(!readJsonString(position, last, value))
+                        {
+                            record.problem = "malformed string value of \"" + key + "\"";
+                            return;
+                        }
+                    }
+                    else if(position < last && (*position == '{' || *position == '['))
+                    {
+                        record.problem = "nested value of \"" + key + "\" is not supported";
+                        return;
+                    }
+                    else
+                    {
+                        const char *literal = position;
+                        while(position < last && *position != ',' && *position != '}' && !std::isspace(static_cast<unsigned char>(*position)))
+                        {
+                            ++position;
+                        }
+                        value.assign(literal, position);
+                        isNull = value == "null";
+                        if(value.empty())
+                        {
+                            record.problem = "missing value of \"" + key + "\"";
+                            return;
+                        }
+                    }
+
+                    for(size_t field = 0; field < fieldNames.size(); ++field)
+                    {
+                        if(fieldNames[field] == key && !isNull)
+                        {
+                            record.values[field].swap(value);
+                            record.present[field] = 1;
+                            break;
+                        }
+                    }
+
+                    skipSpace(position, last);
+                    if(position < last && *position == ',')
+                    {
+                        ++position;
+                        continue;
+                    }
+                    if(position < last && *position == '}')
+                    {
+                        ++position;
+                        break;
+                    }
+                    record.problem = "expected ',' or '}' after \"" + key + "\"";
+                    return;
+                }
+            }
+
+            skipSpace(position, last);
+            if(position != last)
+            {
+                record.problem = "unexpected text after the object";
+                return;
+            }
+            for(size_t field = 0; field < requiredFields; ++field)
+            {
+                if(!record.present[field])
+                {
+                    record.problem = "missing field \"" + fieldNames[field] + "\"";
+                    return;
+                }
+            }
+        }
+
+    public:
+        FeedReader(){};
+
+        FeedReader(const FeedReader &) = delete;
+        FeedReader &operator=(const FeedReader &) = delete;
+
+        // Pick the format from the file name: .csv, or .jsonl / .ndjson / .json for JSON Lines
+        static bool formatOf(const string &fileName, Format &format)
+        {
+            size_t dot = fileName.find_last_of('.');
+            string extension = dot == string::npos ? string() : lowered(fileName.substr(dot + 1));
+
+            if(extension == "csv")
+            {
+                format = CSV;
+                return true;
+            }
+            if(extension == "jsonl" || extension == "ndjson" || extension == "json")
+            {
+                format = JSON_LINES;
+                return true;
+            }
+            return false;
+        }
+
+        // Open a feed and read the named fields (lowercase) from each record; the first required ones must be
+        // in every record. False, with error() saying why, if the feed cannot be read.
+        bool open(const char *fileName, Format feedFormat, const std::vector<string> &fields, size_t required)
+        {
+            input.close();
+            input.clear();
+            input.open(fileName, std::ios::binary);
+            format = feedFormat;
+            fieldNames = fields;
+            requiredFields = required;
+            columnFields.clear();
+            buffer.assign(CHUNK_SIZE, 0);
+            begin = end = 0;
+            atEnd = false;
+            nextLine = 1;
+            recordLine = 0;
+            consumed = 0;
+            failure.clear();
+
+            if(!input.is_open())
+            {
+                failure = "Failed to open feed file.";
+                return false;
+            }
+            return format == JSON_LINES || readHeader();
+        }
+
+        // Read the next record; false at the end of the feed. A record that cannot be parsed is still returned,
+        // with its problem set.
+        bool next(FeedRecord &record)
+        {
+            StringRef text;
+
+            do
+            {
+                if(!nextText(text))
+                {
+                    return false;
+                }
+            }
+            while(!oversized && isBlank(text));
+
+            record.values.resize(fieldNames.size());
+            record.present.assign(fieldNames.size(), 0);
+            record.problem.clear();
+            for(auto &value : record.values)
+            {
+                value.clear();
+            }
+
+            if(oversized)
+            {
+                record.problem = "record longer than " + std::to_string(MAX_RECORD_SIZE) + " bytes";
+            }
+            else if(format == CSV)
+            {
+                parseCsv(text, record);
+            }
+            else
+            {
+                parseJson(text, record);
+            }
+            return true;
+        }
+
+        // Line of the feed the last record started on
+        uint64_t line() const
+        {
+            return recordLine;
+        }
+
+        // Bytes of the feed consumed so far
+        uint64_t bytesRead() const
+        {
+            return consumed;
+        }
+
+        // Why the feed could not be opened or read to the end, if it could not
+        const string &error() const
+        {
+            return failure;
+        }
+};
+
+const size_t ImportReport::MAX_PROBLEMS;
+const size_t FeedReader::MAX_RECORD_SIZE;
+const size_t FeedReader::CHUNK_SIZE;
+const size_t FeedReader::NO_FIELD;
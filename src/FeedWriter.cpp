@@ -0,0 +1,206 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "FileWriter.cpp"
+#include "FeedReader.cpp"
+
+using std::string;
+
+// Outcome of an export
+struct ExportReport
+{
+    uint64_t records = 0;
+    uint64_t bytes = 0;
+    double seconds = 0;
+};
+
+// Writes records as CSV (with a header line) or JSON Lines, in the formats FeedReader reads.
+// Values are escaped straight into the buffer of an AtomicFileWriter, so nothing is copied per record and
+// memory use does not depend on the export size; the file only replaces an existing one once complete.
+class FeedWriter
+{
+    private:
+        AtomicFileWriter file;
+        FeedReader::Format format = FeedReader::CSV;
+        std::vector<string> columns;
+        size_t column = 0;
+
+        // Start the next value of the current record
+        void separate()
+        {
+            if(format == FeedReader::CSV)
+            {
+                if(column > 0)
+                {
+                    file.write(',');
+                }
+            }
+            else
+            {
+                file.write(column == 0 ? '{' : ',');
+                writeJsonString(columns[column].data(), columns[column].size());
+                file.write(':');
+            }
+            ++column;
+        }
+
+        void writeJsonString(const char *text, size_t size)
+        {
+            static const char HEX[] = "0123456789abcdef";
+            size_t plain = 0;
+
+            file.write('"');
+            for(size_t i = 0; i < size; ++i)
+            {
+                unsigned char character = static_cast<unsigned char>(text[i]);
+                if(character >= 0x20 && character != '"' && character != '\\')
+                {
+                    continue;
+                }
+
+                file.write(text + plain, i - plain);
+                plain = i + 1;
+                switch(character)
+                {
+                    case '"': file.write("\\\"", 2); break;
+                    case '\\': file.write("\\\\", 2); break;
+                    case '\n': file.write("\\n", 2); break;
+                    case '\r': file.write("\\r", 2); break;
+                    case '\t': file.write("\\t", 2); break;
+                    default:
+                        {
+                            char escape[6] = {'\\', 'u', '0', '0', HEX[character >> 4], HEX[character & 15]};
+                            file.write(escape, sizeof(escape));
+                        }
+                }
+            }
+            file.write(text + plain, size - plain);
+            file.write('"');
+        }
+
+        void writeCsvString(const char *text, size_t size)
+        {
+            bool quote = false;
+            for(size_t i = 0; i < size && !quote; ++i)
+            {
+                quote = text[i] == ',' || text[i] == '"' || text[i] == '\n' || text[i] == '\r';
+            }
+            if(!quote)
+            {
+                file.write(text, size);
+                return;
+            }
+
+            size_t plain = 0;
+            file.write('"');
+            for(size_t i = 0; i < size; ++i)
+            {
+                if(text[i] == '"')
+                {
+                    file.write(text + plain, i + 1 - plain);
+                    plain = i;
+                }
+            }
+            file.write(text + plain, size - plain);
+            file.write('"');
+        }
+
+    public:
+        FeedWriter(){};
+
+        FeedWriter(const FeedWriter &) = delete;
+        FeedWriter &operator=(const FeedWriter &) = delete;
+
+        // Start writing a feed with the given columns; false if the file cannot be created
+        bool open(const char *fileName, FeedReader::Format feedFormat, const std::vector<string> &names)
+        {
+            format = feedFormat;
+            columns = names;
+            column = 0;
+            if(!file.open(fileName))
+            {
+                return false;
+            }
+
+            if(format == FeedReader::CSV)
+            {
+                for(const auto &name : columns)
+                {
+                    field(StringRef(name.data(), name.size()));
+                }
+                endRecord();
+            }
+            return true;
+        }
+
+        // Append the next value of the current record, in column order
+        void field(StringRef text)
+        {
+            separate();
+            if(format == FeedReader::CSV)
+            {
+                writeCsvString(text.data(), text.size());
+            }
+            else
+            {
+                writeJsonString(text.data(), text.size());
+            }
+        }
+
+        void field(int value)
+        {
+            char digits[12];
+            size_t size = 0;
+            unsigned int magnitude = value < 0 ? 0u - static_cast<unsigned int>(value) : static_cast<unsigned int>(value);
+
+            do
+            {
+                digits[sizeof(digits) - ++size] = static_cast<char>('0' + magnitude % 10);
+                magnitude /= 10;
+            }
+            while(magnitude > 0);
+            if(value < 0)
+            {
+                digits[sizeof(digits) - ++size] = '-';
+            }
+
+            separate();
+            file.write(digits + sizeof(digits) - size, size);
+        }
+
+        void field(bool value)
+        {
+            separate();
+            if(format == FeedReader::CSV)
+            {
+                file.write(value ? "yes" : "no", value ? 3 : 2);
+            }
+            else
+            {
+                file.write(value ? "true" : "false", value ? 4 : 5);
+            }
+        }
+
+        // End the current record
+        void endRecord()
+        {
+            if(format == FeedReader::JSON_LINES)
+            {
+                file.write('}');
+            }
+            file.write('\n');
+            column = 0;
+        }
+
+        uint64_t bytesWritten() const
+        {
+            return file.position();
+        }
+
+        // Sync the feed and put it in place; false if anything failed to write
+        bool finish()
+        {
+            return file.commit();
+        }
+};
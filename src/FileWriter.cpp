@@ -0,0 +1,434 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdio>
+#include <cstdint>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <cerrno>
+#endif
+
+#include "StringArena.cpp"
+
+using std::string;
+
+// Unbuffered, write-only file handle with explicit sync, on top of the OS API
+class OutputFile
+{
+    private:
+#ifdef _WIN32
+        HANDLE file = INVALID_HANDLE_VALUE;
+#else
+        int file = -1;
+#endif
+
+    public:
+        OutputFile(){};
+
+        OutputFile(const OutputFile &) = delete;
+        OutputFile &operator=(const OutputFile &) = delete;
+
+        ~OutputFile()
+        {
+            close();
+        }
+
+        // Open a file for writing, either emptying it or keeping its first keepLength bytes and appending after them
+        bool open(const char *fileName, bool truncate, uint64_t keepLength = 0)
+        {
+            close();
+#ifdef _WIN32
+            file = CreateFileA(fileName, GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, truncate ? CREATE_ALWAYS : OPEN_ALWAYS,
+                               FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+#else
+            file = ::open(fileName, O_WRONLY | O_CREAT | (truncate ? O_TRUNC : 0), 0644);
+#endif
+            if(!isOpen())
+            {
+                return false;
+            }
+            // A file already keepLength long is only positioned at its end: Windows refuses to set the end of a
+            // file that is mapped
+            if(!truncate && !(length() == keepLength ? seek(keepLength) : resize(keepLength)))
+            {
+                close();
+                return false;
+            }
+            return true;
+        }
+
+        // Length of a file on disk, or UINT64_MAX if it cannot be found
+        static uint64_t lengthOf(const char *fileName)
+        {
+#ifdef _WIN32
+            WIN32_FILE_ATTRIBUTE_DATA attributes;
+            if(!GetFileAttributesExA(fileName, GetFileExInfoStandard, &attributes))
+            {
+                return UINT64_MAX;
+            }
+            return (static_cast<uint64_t>(attributes.nFileSizeHigh) << 32) | attributes.nFileSizeLow;
+#else
+            struct stat status;
+            return stat(fileName, &status) == 0 ? static_cast<uint64_t>(status.st_size) : UINT64_MAX;
+#endif
+        }
+
+        // Length of the open file, or UINT64_MAX if it cannot be found
+        uint64_t length() const
+        {
+#ifdef _WIN32
+            LARGE_INTEGER size;
+            return GetFileSizeEx(file, &size) ? static_cast<uint64_t>(size.QuadPart) : UINT64_MAX;
+#else
+            struct stat status;
+            return fstat(file, &status) == 0 ? static_cast<uint64_t>(status.st_size) : UINT64_MAX;
+#endif
+        }
+
+        bool isOpen() const
+        {
+#ifdef _WIN32
+            return file != INVALID_HANDLE_VALUE;
+#else
+            return file >= 0;
+#endif
+        }
+
+        // Write all bytes; false on any error
+        bool write(const char *data, size_t size)
+        {
+            while(size > 0)
+            {
+#ifdef _WIN32
+                DWORD chunk = static_cast<DWORD>(size > (1u << 30) ? (1u << 30) : size);
+                DWORD written = 0;
+                if(!WriteFile(file, data, chunk, &written, nullptr))
+                {
+                    return false;
+                }
+#else
+                ssize_t written = ::write(file, data, size);
+                if(written < 0)
+                {
+                    if(errno == EINTR)
+                    {
+                        continue;
+                    }
+                    return false;
+                }
+#endif
+                data += written;
+                size -= written;
+            }
+            return true;
+        }
+
+        // Overwrite bytes at a position without moving the append position
+        bool writeAt(uint64_t offset, const char *data, size_t size)
+        {
+#ifdef _WIN32
+            // A positioned WriteFile on a synchronous handle moves the file pointer, so put it back afterwards
+            LARGE_INTEGER zero = {}, appendPosition;
+            if(!SetFilePointerEx(file, zero, &appendPosition, FILE_CURRENT))
+            {
+                return false;
+            }
+#endif
+            while(size > 0)
+            {
+#ifdef _WIN32
+                OVERLAPPED position = {};
+                position.Offset = static_cast<DWORD>(offset);
+                position.OffsetHigh = static_cast<DWORD>(offset >> 32);
+                DWORD chunk = static_cast<DWORD>(size > (1u << 30) ? (1u << 30) : size);
+                DWORD written = 0;
+                if(!WriteFile(file, data, chunk, &written, &position))
+                {
+                    return false;
+                }
+#else
+                ssize_t written = pwrite(file, data, size, static_cast<off_t>(offset));
+                if(written < 0)
+                {
+                    if(errno == EINTR)
+                    {
+                        continue;
+                    }
+                    return false;
+                }
+#endif
+                data += written;
+                size -= written;
+                offset += written;
+            }
+#ifdef _WIN32
+            return SetFilePointerEx(file, appendPosition, nullptr, FILE_BEGIN) != 0;
+#else
+            return true;
+#endif
+        }
+
+        // Continue writing at a position
+        bool seek(uint64_t position)
+        {
+#ifdef _WIN32
+            LARGE_INTEGER offset;
+            offset.QuadPart = static_cast<LONGLONG>(position);
+            return SetFilePointerEx(file, offset, nullptr, FILE_BEGIN) != 0;
+#else
+            return lseek(file, static_cast<off_t>(position), SEEK_SET) >= 0;
+#endif
+        }
+
+        // Cut or extend the file to a length and continue writing at its end
+        bool resize(uint64_t length)
+        {
+#ifdef _WIN32
+            LARGE_INTEGER position;
+            position.QuadPart = static_cast<LONGLONG>(length);
+            return SetFilePointerEx(file, position, nullptr, FILE_BEGIN) && SetEndOfFile(file);
+#else
+            return ftruncate(file, static_cast<off_t>(length)) == 0 && lseek(file, static_cast<off_t>(length), SEEK_SET) >= 0;
+#endif
+        }
+
+        // Push written data through to the disk
+        bool sync()
+        {
+#ifdef _WIN32
+            return FlushFileBuffers(file) != 0;
+#else
+            return fsync(file) == 0;
+#endif
+        }
+
+        void close()
+        {
+            if(!isOpen())
+            {
+                return;
+            }
+#ifdef _WIN32
+            CloseHandle(file);
+            file = INVALID_HANDLE_VALUE;
+#else
+            ::close(file);
+            file = -1;
+#endif
+        }
+
+        // Make a rename or create inside a directory durable by syncing the directory itself
+        static void syncDirectoryOf(const string &fileName)
+        {
+#ifndef _WIN32
+            size_t slash = fileName.find_last_of('/');
+            string directory = slash == string::npos ? "." : (slash == 0 ? "/" : fileName.substr(0, slash));
+            int descriptor = ::open(directory.c_str(), O_RDONLY);
+
+            if(descriptor >= 0)
+            {
+                fsync(descriptor);
+                ::close(descriptor);
+            }
+#else
+            (void)fileName;
+#endif
+        }
+};
+
+// Encodes values into a growing in-memory buffer, in the same layout the file writers use
+class ByteWriter
+{
+    private:
+        string bytes;
+
+    public:
+        ByteWriter(){};
+
+        void write(const char *data, size_t size)
+        {
+            bytes.append(data, size);
+        }
+
+        // Append an int, bool, ... in memory layout
+        template<typename T>
+        void write(const T &data)
+        {
+            write(reinterpret_cast<const char*>(&data), sizeof(data));
+        }
+
+        const char *data() const
+        {
+            return bytes.data();
+        }
+
+        size_t size() const
+        {
+            return bytes.size();
+        }
+
+        void clear()
+        {
+            bytes.clear();
+        }
+};
+
+// Writes a file atomically: data is encoded into a large buffer, flushed in big writes to "<name>.tmp",
+// synced to disk and only then renamed over the target. A crash or error at any point leaves the old file intact.
+class AtomicFileWriter
+{
+    private:
+        static const size_t BUFFER_SIZE = 1 << 20;
+
+        string fileName;
+        string tempName;
+        OutputFile file;
+        std::vector<char> buffer;
+        size_t used = 0;
+        uint64_t written = 0;
+        bool failed = false;
+
+        // Write bytes straight to the temp file
+        void writeRaw(const char *data, size_t size)
+        {
+            if(!failed)
+            {
+                failed = !file.write(data, size);
+                written += size;
+            }
+        }
+
+    public:
+        AtomicFileWriter(){};
+
+        AtomicFileWriter(const AtomicFileWriter &) = delete;
+        AtomicFileWriter &operator=(const AtomicFileWriter &) = delete;
+
+        // An unfinished write is thrown away
+        ~AtomicFileWriter()
+        {
+            discard();
+        }
+
+        // Start writing a new version of a file; false if the temp file cannot be created
+        bool open(const char *name)
+        {
+            discard();
+            fileName = name;
+            tempName = fileName + ".tmp";
+            buffer.resize(BUFFER_SIZE);
+            used = 0;
+            written = 0;
+            failed = false;
+            return file.open(tempName.c_str(), true);
+        }
+
+        // Append bytes, going through the buffer unless they are large enough to write directly
+        void write(const char *data, size_t size)
+        {
+            if(size > buffer.size() - used)
+            {
+                flush();
+                if(size >= buffer.size())
+                {
+                    writeRaw(data, size);
+                    return;
+                }
+            }
+            std::memcpy(&buffer[used], data, size);
+            used += size;
+        }
+
+        // Append an int, bool, ... in memory layout
+        template<typename T>
+        void write(const T &data)
+        {
+            write(reinterpret_cast<const char*>(&data), sizeof(data));
+        }
+
+        void flush()
+        {
+            writeRaw(buffer.data(), used);
+            used = 0;
+        }
+
+        // True while every write so far has succeeded
+        bool good() const
+        {
+            return file.isOpen() && !failed;
+        }
+
+        // Number of bytes written so far, i.e. the offset the next write lands at
+        uint64_t position() const
+        {
+            return written + used;
+        }
+
+        // Overwrite already written bytes (e.g. a header whose contents are only known at the end)
+        void writeAt(uint64_t offset, const char *data, size_t size)
+        {
+            flush();
+            if(!failed)
+            {
+                failed = !file.writeAt(offset, data, size);
+            }
+        }
+
+        // Flush and sync the temp file to disk; the target is not touched yet
+        bool finish()
+        {
+            if(!file.isOpen())
+            {
+                return false;
+            }
+            flush();
+            failed = failed || !file.sync();
+            file.close();
+            return !failed;
+        }
+
+        // Replace the target with the finished temp file
+        bool commit()
+        {
+            if(failed || tempName.empty() || (file.isOpen() && !finish()))
+            {
+                return false;
+            }
+
+#ifdef _WIN32
+            bool renamed = MoveFileExA(tempName.c_str(), fileName.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+            bool renamed = std::rename(tempName.c_str(), fileName.c_str()) == 0;
+#endif
+            if(!renamed)
+            {
+                return false;
+            }
+            tempName.clear();
+            OutputFile::syncDirectoryOf(fileName);
+            return true;
+        }
+
+        // Drop the temp file without touching the target
+        void discard()
+        {
+            file.close();
+            if(!tempName.empty())
+            {
+                std::remove(tempName.c_str());
+                tempName.clear();
+            }
+        }
+};
@@ -0,0 +1,70 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+using std::string;
+
+// Interns string IDs into dense integer handles (0, 1, 2, ...).
+// A handle stays bound to its ID for the lifetime of the dictionary, even after the record is deleted,
+// so handles can be used as array indexes and compared as plain integers.
+class IdDictionary
+{
+    private:
+        std::unordered_map<string, uint32_t> handles;
+        std::vector<const string*> ids;
+
+    public:
+        static const uint32_t NO_HANDLE = 0xFFFFFFFF;
+
+        IdDictionary(){};
+
+        IdDictionary(const IdDictionary &) = delete;
+        IdDictionary &operator=(const IdDictionary &) = delete;
+
+        // Get the handle of an ID, creating one if the ID is new
+        uint32_t intern(const string &id)
+        {
+            auto result = handles.emplace(id, static_cast<uint32_t>(ids.size()));
+
+            if(result.second)
+            {
+                ids.push_back(&result.first->first);
+            }
+            return result.first->second;
+        }
+
+        // Get the handle of an ID, or NO_HANDLE if it was never interned
+        uint32_t find(const string &id) const
+        {
+            auto it = handles.find(id);
+
+            if(it != handles.end())
+            {
+                return it->second;
+            }
+            return NO_HANDLE;
+        }
+
+        // Get the ID behind a handle
+        const string &name(uint32_t handle) const
+        {
+            return *ids[handle];
+        }
+
+        // Number of handles handed out so far
+        size_t size() const
+        {
+            return ids.size();
+        }
+
+        // Pre-size for an expected number of IDs
+        void reserve(size_t count)
+        {
+            handles.reserve(count);
+            ids.reserve(count);
+        }
+};
+
+const uint32_t IdDictionary::NO_HANDLE;
\ No newline at end of file
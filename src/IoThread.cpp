@@ -0,0 +1,85 @@
+#pragma once
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+
+// A dedicated thread that runs submitted jobs one at a time, in the order they were submitted, so disk work
+// can be handed off by threads that must not wait for it. The thread starts with the first job; destroying
+// the IoThread runs the jobs still queued and then stops it.
+class IoThread
+{
+    private:
+        std::thread worker;
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::deque<std::function<void()>> jobs;
+        bool stopping = false;
+
+        void work()
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            for(;;)
+            {
+                wake.wait(lock, [this] { return stopping || !jobs.empty(); });
+                if(jobs.empty())
+                {
+                    return;
+                }
+
+                std::function<void()> job = std::move(jobs.front());
+                jobs.pop_front();
+                lock.unlock();
+                job();
+                lock.lock();
+            }
+        }
+
+    public:
+        IoThread(){};
+
+        IoThread(const IoThread &) = delete;
+        IoThread &operator=(const IoThread &) = delete;
+
+        ~IoThread()
+        {
+            stop();
+        }
+
+        // Queue a job; the future gets its result (or the exception it threw) once it has run
+        template<typename F>
+        auto submit(F job) -> std::future<decltype(job())>
+        {
+            auto task = std::make_shared<std::packaged_task<decltype(job())()>>(std::move(job));
+            std::future<decltype(job())> result = task->get_future();
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if(!worker.joinable())
+                {
+                    stopping = false;
+                    worker = std::thread(&IoThread::work, this);
+                }
+                jobs.push_back([task] { (*task)(); });
+            }
+            wake.notify_one();
+            return result;
+        }
+
+        // Run the queued jobs and stop the thread
+        void stop()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if(!worker.joinable())
+                {
+                    return;
+                }
+                stopping = true;
+            }
+            wake.notify_one();
+            worker.join();
+        }
+};
@@ -0,0 +1,273 @@
+#pragma once
+#include <string>
+#include <cstdint>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include "FileWriter.cpp"
+#include "MappedFile.cpp"
+#include "Checksum.cpp"
+
+using std::string;
+
+// Append-only write-ahead journal of typed records.
+// Each record is [payload size: uint32][type: uint8][payload][CRC-32 of type and payload: uint32],
+// so a record torn by a crash is detected on replay and cut off.
+// Appends only copy into memory; a background thread writes and syncs whatever has piled up in one go
+// (group commit), so concurrent writers share a single fsync.
+class Journal
+{
+    public:
+        // Longest payload a record may have; replay takes a longer one for a torn tail
+        static const uint32_t MAX_RECORD_SIZE = 64 << 20;
+
+    private:
+        OutputFile file;
+        string fileName;
+
+        std::mutex mutex;
+        std::condition_variable wake;       // pending records or stop request for the flusher
+        std::condition_variable durable;    // the flusher finished a batch
+        std::thread flusher;
+
+        string pending;
+        uint64_t appended = 0;      // sequence number of the last appended record
+        uint64_t synced = 0;        // sequence number of the last record on disk
+        uint64_t fileLength = 0;    // bytes in the file, which end with record synced
+        uint64_t baseOffset = 0;    // where in the file the record after baseSequence starts
+        uint64_t baseSequence = 0;
+        bool writing = false;
+        bool failed = false;
+        bool stopping = false;
+
+        void flushLoop()
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+
+            while(true)
+            {
+                wake.wait(lock, [this]
+                {
+                    return stopping || !pending.empty();
+                });
+                if(pending.empty())
+                {
+                    break;
+                }
+
+                string batch;
+                batch.swap(pending);
+                uint64_t batchEnd = appended;
+                writing = true;
+
+                lock.unlock();
+                bool written = file.write(batch.data(), batch.size()) && file.sync();
+                lock.lock();
+
+                writing = false;
+                failed = failed || !written;
+                fileLength += batch.size();
+                synced = batchEnd;
+                durable.notify_all();
+            }
+        }
+
+        // Replace the file with the records after the given one, with the mutex held and nothing being written
+        bool compactThrough(uint64_t sequence)
+        {
+            AtomicFileWriter compacted;
+            uint64_t tailLength;
+            {
+                MappedFile data;
+                if(!data.open(fileName.c_str()) || data.size() < fileLength)
+                {
+                    return false;
+                }
+
+                // Step over the records up to the checkpoint; the rest is the tail to keep
+                ByteReader reader(data.data() + baseOffset, fileLength - baseOffset);
+                for(uint64_t skipped = baseSequence; skipped < sequence; ++skipped)
+                {
+                    uint32_t payloadSize;
+                    StringRef record;
+                    if(!reader.read(payloadSize) || !reader.take(payloadSize + 1 + sizeof(uint32_t), record))
+                    {
+                        return false;
+                    }
+                }
+                tailLength = reader.remaining();
+
+                if(!compacted.open(fileName.c_str()))
+                {
+                    return false;
+                }
+                compacted.write(data.data() + fileLength - tailLength, tailLength);
+                if(!compacted.finish())
+                {
+                    return false;
+                }
+            }
+
+            // The file is closed while it is replaced (Windows cannot rename over an open file); if that fails,
+            // the old journal is still whole and is opened again
+            file.close();
+            bool replaced = compacted.commit();
+            uint64_t length = replaced ? tailLength : fileLength;
+            if(!file.open(fileName.c_str(), false, length) || !file.sync())
+            {
+                failed = true;
+                return false;
+            }
+            fileLength = length;
+            return replaced;
+        }
+
+    public:
+        Journal(){};
+
+        Journal(const Journal &) = delete;
+        Journal &operator=(const Journal &) = delete;
+
+        ~Journal()
+        {
+            close();
+        }
+
+        // Call function(type, payload) for each intact record of journal data, in order.
+        // Returns the length of the intact prefix; anything after it is a torn or corrupt tail.
+        template<typename F>
+        static size_t forEachRecord(const char *data, size_t size, F function)
+        {
+            ByteReader reader(data, size);
+            size_t valid = 0;
+
+            while(true)
+            {
+                uint32_t payloadSize, storedChecksum;
+                uint8_t type;
+                StringRef body;
+
+                if(!reader.read(payloadSize) || payloadSize > MAX_RECORD_SIZE ||
+                   !reader.take(payloadSize + 1, body) || !reader.read(storedChecksum) ||
+                   Checksum::of(body.data(), body.size()) != storedChecksum)
+                {
+                    return valid;
+                }
+
+                type = static_cast<uint8_t>(body.data()[0]);
+                function(type, ByteReader(body.data() + 1, payloadSize));
+                valid = size - reader.remaining();
+            }
+        }
+
+        // Open a journal for appending after its first validLength bytes (dropping any torn tail)
+        bool open(const char *name, uint64_t validLength)
+        {
+            close();
+            fileName = name;
+            if(!file.open(name, false, validLength) || !file.sync())
+            {
+                return false;
+            }
+            OutputFile::syncDirectoryOf(fileName);
+
+            appended = synced = 0;
+            fileLength = baseOffset = validLength;
+            baseSequence = 0;
+            failed = stopping = false;
+            flusher = std::thread(&Journal::flushLoop, this);
+            return true;
+        }
+
+        bool isOpen() const
+        {
+            return file.isOpen();
+        }
+
+        // Queue a record; returns its sequence number for waitDurable, or 0 if the payload is longer than
+        // MAX_RECORD_SIZE and the record is refused
+        uint64_t append(uint8_t type, const char *payload, size_t size)
+        {
+            if(size > MAX_RECORD_SIZE)
+            {
+                return 0;
+            }
+
+            uint32_t payloadSize = static_cast<uint32_t>(size);
+            Checksum checksum;
+            checksum.update(reinterpret_cast<const char*>(&type), 1);
+            checksum.update(payload, size);
+            uint32_t recordChecksum = checksum.value();
+
+            std::lock_guard<std::mutex> lock(mutex);
+            pending.append(reinterpret_cast<const char*>(&payloadSize), sizeof(payloadSize));
+            pending.append(reinterpret_cast<const char*>(&type), 1);
+            pending.append(payload, size);
+            pending.append(reinterpret_cast<const char*>(&recordChecksum), sizeof(recordChecksum));
+            wake.notify_one();
+            return ++appended;
+        }
+
+        // Block until a record is on disk; false if the journal could not be written
+        bool waitDurable(uint64_t sequence)
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+
+            durable.wait(lock, [this, sequence]
+            {
+                return synced >= sequence || failed || !flusher.joinable();
+            });
+            return synced >= sequence && !failed;
+        }
+
+        // Throw away every record up to a checkpoint (the record with the given sequence number) that has made
+        // them redundant. Records appended after it are copied into a fresh journal that replaces the file, so the
+        // journal stays short however busy the library is; appends wait while that is done.
+        bool resetThrough(uint64_t sequence)
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+
+            durable.wait(lock, [this, sequence]
+            {
+                return (synced >= sequence && !writing) || failed || !flusher.joinable();
+            });
+            if(!file.isOpen() || failed || synced < sequence)
+            {
+                return false;
+            }
+
+            if(synced == sequence)
+            {
+                if(!file.resize(0) || !file.sync())
+                {
+                    failed = true;
+                    return false;
+                }
+                fileLength = 0;
+            }
+            else if(!compactThrough(sequence))
+            {
+                return false;
+            }
+            baseOffset = 0;
+            baseSequence = sequence;
+            return true;
+        }
+
+        // Flush what is queued, stop the background thread and close the file
+        void close()
+        {
+            if(flusher.joinable())
+            {
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    stopping = true;
+                }
+                wake.notify_one();
+                flusher.join();
+            }
+            file.close();
+        }
+};
+
+const uint32_t Journal::MAX_RECORD_SIZE;
@@ -1,140 +1,1851 @@
+#pragma once
 #include <algorithm>
 #include <iomanip>
 #include <fstream>
 #include <sstream>
 #include <cstdint>
+#include <unordered_map>
+#include <unordered_set>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <future>
 #include "Book.cpp"
 #include "Reader.cpp"
+#include "IdDictionary.cpp"
+#include "BookStore.cpp"
+#include "TextIndex.cpp"
+#include "OrderedIndex.cpp"
+#include "BookQuery.cpp"
+#include "BatchOperation.cpp"
+#include "FileWriter.cpp"
+#include "Journal.cpp"
+#include "SegmentedFile.cpp"
+#include "ColumnCodec.cpp"
+#include "Parallel.cpp"
+#include "LockStripes.cpp"
+#include "IoThread.cpp"
+#include "FeedReader.cpp"
+#include "FeedWriter.cpp"
 
 using std::string;
 using std::cout;
 
+// How saving or loading the library files went
+enum PersistStatus
+{
+    PERSIST_OK,
+    PERSIST_NO_BOOK_FILE,           // the book file could not be opened
+    PERSIST_BAD_BOOK_FILE,          // the book file could not be read
+    PERSIST_NO_READER_FILE,
+    PERSIST_BAD_READER_FILE,
+    PERSIST_BOOKS_NOT_WRITTEN,      // nothing was saved
+    PERSIST_READERS_NOT_WRITTEN,    // the books were saved, the readers were not
+    PERSIST_JOURNAL_NOT_CLEARED     // both files were saved, the journal still has the saved changes
+};
+
+// Outcome of an asynchronous save or load
+struct PersistReport
+{
+    PersistStatus status = PERSIST_OK;
+    size_t books = 0;
+    size_t readers = 0;
+    double seconds = 0;
+
+    // Short description of a status, for messages
+    static const char *statusText(PersistStatus status)
+    {
+        switch(status)
+        {
+            case PERSIST_OK: return "OK";
+            case PERSIST_NO_BOOK_FILE: return "cannot open book file";
+            case PERSIST_BAD_BOOK_FILE: return "cannot read book file";
+            case PERSIST_NO_READER_FILE: return "cannot open reader file";
+            case PERSIST_BAD_READER_FILE: return "cannot read reader file";
+            case PERSIST_BOOKS_NOT_WRITTEN: return "failed to write book file";
+            case PERSIST_READERS_NOT_WRITTEN: return "failed to write reader file";
+            case PERSIST_JOURNAL_NOT_CLEARED: return "failed to clear journal";
+        }
+        return "unknown";
+    }
+};
+
 class Library
 {
     private:
-        std::vector<Book> books;
+        BookStore books;
         std::vector<Reader> readers;
 
-        // Find reader by ID
-        Reader* findReader(const string &readerID)
+        // String IDs interned into dense handles; everything below works on handles
+        IdDictionary bookIds;
+        IdDictionary readerIds;
+
+        // Handle of the reader at each position of readers (the book store keeps its own handle column)
+        std::vector<uint32_t> readerHandles;
+
+        // Reader handle -> position in readers (NO_POSITION when there is no such reader),
+        // kept in sync by every operation that adds or removes readers; the book store tracks book rows itself
+        static const size_t NO_POSITION = SIZE_MAX;
+        std::vector<size_t> readerPositions;
+
+        // Title/author/genre -> handles of the books carrying it, so searches only touch matching books
+        typedef std::unordered_map<string, std::unordered_set<uint32_t>> ValueIndex;
+        ValueIndex titleIndex;
+        ValueIndex authorIndex;
+        ValueIndex genreIndex;
+
+        // Tokenized title/author index for keyword, prefix and typo-tolerant search
+        TextIndex textIndex;
+
+        // Publication year -> book handles, for range and newest-first queries
+        OrderedIndex yearIndex;
+
+        // Book handle -> (reader handle, number of copies that reader currently holds)
+        std::vector<std::vector<std::pair<uint32_t, int>>> borrowers;
+
+        // Write-ahead journal of changes since the last save, replayed on top of the saved files at startup
+        enum JournalOperation : uint8_t
+        {
+            LOG_APPEND_BOOK = 1,
+            LOG_APPEND_READER,
+            LOG_EDIT_TITLE,
+            LOG_EDIT_AUTHOR,
+            LOG_EDIT_GENRE,
+            LOG_EDIT_YEAR,
+            LOG_EDIT_DETAIL,
+            LOG_EDIT_READER_NAME,
+            LOG_BORROW,
+            LOG_RETURN,
+            LOG_DELETE_BOOK,
+            LOG_DELETE_READER,
+            LOG_CHECKPOINT,
+            LOG_APPEND_BOOKS,   // a batch of appended books, one after another
+            LOG_BATCH,          // the applied operations of a batch, one after another
+            LOG_BATCH_PART,     // leading operations of a batch too large for one record, continued up to a LOG_BATCH
+            LOG_SAVE_POINT      // where the state a save copied stands; its LOG_CHECKPOINT follows once the save is encoded
+        };
+
+        Journal journal;
+        bool replaying = false;
+        std::vector<BatchOperation> replayedBatch;     // operations of LOG_BATCH_PART records awaiting their LOG_BATCH
+
+        // Saved book and reader files and which of their segments changed since, so a save only writes those
+        SegmentedFile bookSnapshot;
+        SegmentedFile readerSnapshot;
+        SegmentMap bookSegments;
+        SegmentMap readerSegments;
+
+        // Lazy loading: the book file whose segments are decoded on first use (null once every book is decoded),
+        // where each segment was in it, which are decoded now, which are unchanged since loading (so they can be
+        // dropped and decoded again) and when each was last used
+        std::shared_ptr<const MappedFile> lazyBookFile;
+        std::vector<SegmentInfo> lazySegments;
+        std::vector<uint8_t> segmentDecoded;
+        std::vector<uint8_t> segmentPristine;
+        std::vector<std::atomic<uint64_t>> segmentLastUse;
+        std::atomic<uint64_t> useClock{0};
+
+        // Reader records of one file segment copied for a save, loans as book IDs
+        struct SavedReaders
+        {
+            std::vector<string> ids, names;
+            std::vector<int64_t> loanCounts;
+            std::vector<string> loans;
+        };
+
+        // Save running in the background: its worker, whether it is still running, the files and segments it covers,
+        // the records it copied to encode (by segment, empty for segments kept as they are), its number and journal
+        // save point and how writing each file went
+        std::thread saveThread;
+        std::atomic<bool> saveRunning{false};
+        string savingBookFile;
+        string savingReaderFile;
+        std::vector<uint8_t> savingBookSegments;
+        std::vector<uint8_t> savingReaderSegments;
+        std::vector<std::vector<Book>> savedBooks;
+        std::vector<SavedReaders> savedReaders;
+        uint32_t saveNumber = 0;
+        uint64_t saveCheckpoint = 0;
+        bool bookFileSaved = false;
+        bool readerFileSaved = false;
+
+        // Locking. The catalog lock guards the structure of the library: which books and readers there are, their
+        // fields, the dictionaries and the indexes. Changing any of that takes it exclusively; everything else shares it.
+        // Under the shared catalog lock, the loan records circulation changes (a book's borrowers, a reader's loans)
+        // are guarded by striped locks by handle: exclusive to change, shared to read. Book quantities are atomic
+        // counters and need no lock of their own.
+        // Locks are taken catalog first, then book stripes, then reader stripes, stripes in ascending order.
+        typedef std::unique_lock<std::shared_timed_mutex> ExclusiveLock;
+        typedef std::shared_lock<std::shared_timed_mutex> SharedLock;
+        mutable std::shared_timed_mutex catalogMutex;
+        LockStripes bookLocks;
+        LockStripes readerLocks;
+        std::mutex touchMutex;      // segment dirty marks set by circulation under the shared catalog lock
+        std::mutex saveMutex;       // starting and finishing background saves
+
+        // Runs asynchronous saves and loads, one at a time
+        IoThread io;
+
+        // Fields read from an import feed; all but the last are required. Availability follows from the quantity,
+        // so the available column is only checked, as are the flags still stored in book files and the journal.
+        enum FeedField
+        {
+            FEED_ID,
+            FEED_TITLE,
+            FEED_AUTHOR,
+            FEED_GENRE,
+            FEED_YEAR,
+            FEED_QUANTITY,
+            FEED_AVAILABLE
+        };
+
+        // Imported books are indexed and journaled this many at a time
+        static const size_t IMPORT_BATCH = 1 << 16;
+
+        // Imports and batches start a new journal record past this size, well below Journal::MAX_RECORD_SIZE
+        static const size_t JOURNAL_PART_SIZE = 16 << 20;
+
+        // Get or create the handle of a book ID
+        uint32_t internBook(const string &bookID)
+        {
+            uint32_t handle = bookIds.intern(bookID);
+
+            if(handle >= borrowers.size())
+            {
+                borrowers.resize(handle + 1);
+            }
+            return handle;
+        }
+
+        // Get or create the handle of a reader ID
+        uint32_t internReader(const string &readerID)
+        {
+            uint32_t handle = readerIds.intern(readerID);
+
+            if(handle >= readerPositions.size())
+            {
+                readerPositions.resize(handle + 1, NO_POSITION);
+            }
+            return handle;
+        }
+
+        // Get the handle of an existing book, or NO_HANDLE
+        uint32_t findBookHandle(const string &bookID) const
+        {
+            uint32_t handle = bookIds.find(bookID);
+
+            if(handle == IdDictionary::NO_HANDLE || books.rowOf(handle) == BookStore::NO_ROW)
+            {
+                return IdDictionary::NO_HANDLE;
+            }
+            return handle;
+        }
+
+        // Get the handle of an existing reader, or NO_HANDLE
+        uint32_t findReaderHandle(const string &readerID) const
+        {
+            uint32_t handle = readerIds.find(readerID);
+
+            if(handle == IdDictionary::NO_HANDLE || readerPositions[handle] == NO_POSITION)
+            {
+                return IdDictionary::NO_HANDLE;
+            }
+            return handle;
+        }
+
+        // Record a loan in the reverse borrow index
+        void addBorrower(uint32_t bookHandle, uint32_t readerHandle)
+        {
+            for(auto &borrower : borrowers[bookHandle])
+            {
+                if(borrower.first == readerHandle)
+                {
+                    ++borrower.second;
+                    return;
+                }
+            }
+            borrowers[bookHandle].push_back(std::make_pair(readerHandle, 1));
+        }
+
+        // Remove a loan from the reverse borrow index
+        void removeBorrower(uint32_t bookHandle, uint32_t readerHandle)
+        {
+            auto &bookBorrowers = borrowers[bookHandle];
+
+            for(auto it = bookBorrowers.begin(); it != bookBorrowers.end(); ++it)
+            {
+                if(it->first == readerHandle)
+                {
+                    if(--it->second == 0)
+                    {
+                        *it = bookBorrowers.back();
+                        bookBorrowers.pop_back();
+                    }
+                    return;
+                }
+            }
+        }
+
+        // Check the reverse borrow index for a loan
+        bool hasBorrower(uint32_t bookHandle, uint32_t readerHandle) const
+        {
+            for(const auto &borrower : borrowers[bookHandle])
+            {
+                if(borrower.first == readerHandle)
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // Register all loans held by a reader in the reverse borrow index
+        void indexLoans(uint32_t readerHandle, const Reader &reader)
+        {
+            for(uint32_t bookHandle : reader.getBorrowedBooks())
+            {
+                addBorrower(bookHandle, readerHandle);
+            }
+        }
+
+        // Add a book handle under a key of a secondary index
+        void addToIndex(ValueIndex &index, const string &key, uint32_t bookHandle)
+        {
+            index[key].insert(bookHandle);
+        }
+
+        // Remove a book handle from under a key of a secondary index, dropping the key once empty
+        void removeFromIndex(ValueIndex &index, const string &key, uint32_t bookHandle)
         {
-            auto it = std::find_if(readers.begin(), readers.end(), [&readerID](Reader &reader)
+            auto it = index.find(key);
+
+            if(it != index.end())
             {
-                return reader.getId() == readerID;
+                it->second.erase(bookHandle);
+                if(it->second.empty())
+                {
+                    index.erase(it);
+                }
+            }
+        }
+
+        // Register the book at a row in the secondary indexes
+        void indexBook(size_t row)
+        {
+            uint32_t handle = books.getHandle(row);
+
+            addToIndex(titleIndex, books.getTitle(row), handle);
+            addToIndex(authorIndex, books.getAuthor(row), handle);
+            addToIndex(genreIndex, books.getGenre(row), handle);
+            textIndex.add(handle, books.getTitle(row), books.getAuthor(row));
+            yearIndex.insert(books.getYear(row), handle);
+        }
+
+        // Add rows to the secondary indexes. The indexes are independent of each other, so each one is built on its own thread.
+        void indexBooks(const std::vector<size_t> &rows)
+        {
+            Parallel::invoke({
+                [this, &rows]
+                {
+                    for(size_t row : rows)
+                    {
+                        addToIndex(titleIndex, books.getTitle(row), books.getHandle(row));
+                    }
+                },
+                [this, &rows]
+                {
+                    for(size_t row : rows)
+                    {
+                        addToIndex(authorIndex, books.getAuthor(row), books.getHandle(row));
+                    }
+                },
+                [this, &rows]
+                {
+                    for(size_t row : rows)
+                    {
+                        addToIndex(genreIndex, books.getGenre(row), books.getHandle(row));
+                    }
+                },
+                [this, &rows]
+                {
+                    for(size_t row : rows)
+                    {
+                        textIndex.add(books.getHandle(row), books.getTitle(row), books.getAuthor(row));
+                    }
+                },
+                [this, &rows]
+                {
+                    for(size_t row : rows)
+                    {
+                        yearIndex.insert(books.getYear(row), books.getHandle(row));
+                    }
+                }
             });
+        }
+
+        // Fill in the rows of a lazily loaded book segment from the file, adding them to rows
+        void fillBookSegment(uint32_t segment, std::vector<size_t> &rows)
+        {
+            if(!lazyBookFile || segment >= lazySegments.size() || segmentDecoded[segment])
+            {
+                return;
+            }
+            segmentDecoded[segment] = 1;
+
+            // The segment's checksum was verified when its IDs were loaded
+            const SegmentInfo &info = lazySegments[segment];
+            ByteReader file(lazyBookFile->data() + info.offset, info.length);
+            BookColumns columns;
+            if(!decodeBookColumns(file, info.count, columns))
+            {
+                cout << "Error: Failed to read book data.\n";
+                return;
+            }
+
+            std::vector<string> genres(columns.genres.begin(), columns.genres.end());
+            for(size_t i = 0; i < columns.ids.size(); ++i)
+            {
+                uint32_t handle = bookIds.find(columns.ids[i]);
+                size_t row = books.rowOf(handle);
+
+                // Books deleted or re-added since loading are left alone
+                if(row == BookStore::NO_ROW || bookSegments.segmentOf(handle) != segment)
+                {
+                    continue;
+                }
+                books.fill(row, columns.titles[i], columns.authors[columns.authorCodes[i]], genres[columns.genreCodes[i]],
+                           columns.years[i], columns.quantities[i]);
+                rows.push_back(row);
+            }
+        }
+
+        // Decode and index the books of a segment, if it is still only in the file. A segment is too small to be
+        // worth starting indexBooks' threads for, so it is indexed on this one.
+        void loadBookSegment(uint32_t segment)
+        {
+            std::vector<size_t> rows;
+
+            fillBookSegment(segment, rows);
+            for(size_t row : rows)
+            {
+                indexBook(row);
+            }
+        }
+
+        // Decode and index every book still only in the file (before anything that looks at the whole catalog)
+        void loadAllBooks()
+        {
+            if(!lazyBookFile)
+            {
+                return;
+            }
+
+            std::vector<size_t> rows;
+            for(uint32_t segment = 0; segment < lazySegments.size(); ++segment)
+            {
+                fillBookSegment(segment, rows);
+            }
+            indexBooks(rows);
+        }
+
+        // Get the row of a book, decoding its full record first if needed
+        size_t loadedRowOf(uint32_t handle)
+        {
+            uint32_t segment = bookSegments.segmentOf(handle);
+
+            if(lazyBookFile && segment < lazySegments.size())
+            {
+                loadBookSegment(segment);
+                segmentLastUse[segment] = ++useClock;
+            }
+            return books.rowOf(handle);
+        }
+
+        // Forget the lazily loaded file, once every book is decoded
+        void finishLazyLoading()
+        {
+            lazyBookFile.reset();
+            lazySegments.clear();
+            segmentDecoded.clear();
+            segmentPristine.clear();
+            segmentLastUse.clear();
+        }
+
+        // Whether a book still has to be decoded from the lazily loaded file. Decoding adds to the catalog,
+        // so it needs the exclusive lock.
+        bool needsDecoding(const string &bookID) const
+        {
+            uint32_t segment = bookSegments.segmentOf(bookIds.find(bookID));
+
+            return lazyBookFile && segment < lazySegments.size() && !segmentDecoded[segment];
+        }
+
+        // Whether any book still has to be decoded from the lazily loaded file
+        bool needsDecodingAny() const
+        {
+            return lazyBookFile && std::find(segmentDecoded.begin(), segmentDecoded.end(), 0) != segmentDecoded.end();
+        }
+
+        // Remove the book at a row from the secondary indexes
+        void unindexBook(size_t row)
+        {
+            uint32_t handle = books.getHandle(row);
+
+            removeFromIndex(titleIndex, books.getTitle(row), handle);
+            removeFromIndex(authorIndex, books.getAuthor(row), handle);
+            removeFromIndex(genreIndex, books.getGenre(row), handle);
+            textIndex.remove(handle);
+            yearIndex.erase(books.getYear(row), handle);
+        }
+
+        // Get the exact-match index serving a query leaf, if any
+        const ValueIndex *exactIndexFor(BookQuery::Kind kind) const
+        {
+            switch(kind)
+            {
+                case BookQuery::TITLE:
+                    return &titleIndex;
+                case BookQuery::AUTHOR:
+                    return &authorIndex;
+                case BookQuery::GENRE:
+                    return &genreIndex;
+                default:
+                    return nullptr;
+            }
+        }
+
+        // Check whether a query can enumerate its candidates from indexes instead of scanning the catalog
+        bool isIndexed(const BookQuery &query) const
+        {
+            switch(query.getKind())
+            {
+                case BookQuery::TITLE:
+                case BookQuery::AUTHOR:
+                case BookQuery::GENRE:
+                case BookQuery::YEAR_RANGE:
+                    return true;
+                case BookQuery::AND:
+                    for(const auto &child : query.getChildren())
+                    {
+                        if(isIndexed(child))
+                        {
+                            return true;
+                        }
+                    }
+                    return false;
+                case BookQuery::OR:
+                    for(const auto &child : query.getChildren())
+                    {
+                        if(!isIndexed(child))
+                        {
+                            return false;
+                        }
+                    }
+                    return true;
+                default:
+                    return false;
+            }
+        }
+
+        // Upper bound on the number of books a query can match, read from index sizes
+        size_t estimate(const BookQuery &query) const
+        {
+            switch(query.getKind())
+            {
+                case BookQuery::TITLE:
+                case BookQuery::AUTHOR:
+                case BookQuery::GENRE:
+                    {
+                        const auto *index = exactIndexFor(query.getKind());
+                        auto it = index->find(query.getValue());
+                        return it == index->end() ? 0 : it->second.size();
+                    }
+                case BookQuery::YEAR_RANGE:
+                    return yearIndex.count(query.getFromYear(), query.getToYear());
+                case BookQuery::AND:
+                    {
+                        size_t smallest = books.size();
+                        for(const auto &child : query.getChildren())
+                        {
+                            smallest = (std::min)(smallest, estimate(child));
+                        }
+                        return smallest;
+                    }
+                case BookQuery::OR:
+                    {
+                        size_t sum = 0;
+                        for(const auto &child : query.getChildren())
+                        {
+                            sum += estimate(child);
+                        }
+                        return (std::min)(sum, books.size());
+                    }
+                default:
+                    return books.size();
+            }
+        }
+
+        // AND a query into a per-row mask by running it over whole columns.
+        // Genre, year and availability are tight-loop column filters; title and author mark their posting lists.
+        void filterRows(const BookQuery &query, std::vector<uint8_t> &mask) const
+        {
+            switch(query.getKind())
+            {
+                case BookQuery::TITLE:
+                case BookQuery::AUTHOR:
+                    {
+                        std::vector<uint8_t> hits(books.size(), 0);
+                        const auto *index = exactIndexFor(query.getKind());
+                        auto it = index->find(query.getValue());
+                        if(it != index->end())
+                        {
+                            for(uint32_t handle : it->second)
+                            {
+                                hits[books.rowOf(handle)] = 1;
+                            }
+                        }
+                        for(size_t i = 0; i < mask.size(); ++i)
+                        {
+                            mask[i] &= hits[i];
+                        }
+                        break;
+                    }
+                case BookQuery::GENRE:
+                    {
+                        uint32_t code = books.findGenreCode(query.getValue());
+                        if(code == IdDictionary::NO_HANDLE)
+                        {
+                            std::fill(mask.begin(), mask.end(), 0);
+                        }
+                        else
+                        {
+                            books.filterGenre(code, mask);
+                        }
+                        break;
+                    }
+                case BookQuery::YEAR_RANGE:
+                    books.filterYearRange(query.getFromYear(), query.getToYear(), mask);
+                    break;
+                case BookQuery::AVAILABLE:
+                    books.filterAvailable(mask);
+                    break;
+                case BookQuery::AND:
+                    for(const auto &child : query.getChildren())
+                    {
+                        filterRows(child, mask);
+                    }
+                    break;
+                case BookQuery::OR:
+                    {
+                        std::vector<uint8_t> any(books.size(), 0);
+                        std::vector<uint8_t> childMask;
+                        for(const auto &child : query.getChildren())
+                        {
+                            childMask.assign(books.size(), 1);
+                            filterRows(child, childMask);
+                            for(size_t i = 0; i < any.size(); ++i)
+                            {
+                                any[i] |= childMask[i];
+                            }
+                        }
+                        for(size_t i = 0; i < mask.size(); ++i)
+                        {
+                            mask[i] &= any[i];
+                        }
+                        break;
+                    }
+            }
+        }
+
+        // Decide between index lookups and a columnar scan: scan when no index applies
+        // or when the best index would still hand back a large share of the catalog
+        bool shouldScan(const BookQuery &query) const
+        {
+            return !isIndexed(query) || estimate(query) > books.size() / 4;
+        }
+
+        // Call a function once for every position of a candidate book: a superset of the query's matches.
+        // AND is driven by its most selective indexed child; OR visits each child and skips books an earlier
+        // child already produced; anything else falls back to a catalog scan.
+        void visitCandidates(const BookQuery &query, const std::function<void(size_t)> &function) const
+        {
+            if(!isIndexed(query))
+            {
+                for(size_t i = 0; i < books.size(); ++i)
+                {
+                    function(i);
+                }
+                return;
+            }
+
+            switch(query.getKind())
+            {
+                case BookQuery::TITLE:
+                case BookQuery::AUTHOR:
+                case BookQuery::GENRE:
+                    {
+                        const auto *index = exactIndexFor(query.getKind());
+                        auto it = index->find(query.getValue());
+                        if(it != index->end())
+                        {
+                            for(uint32_t handle : it->second)
+                            {
+                                function(books.rowOf(handle));
+                            }
+                        }
+                        break;
+                    }
+                case BookQuery::YEAR_RANGE:
+                    yearIndex.forEachInRange(query.getFromYear(), query.getToYear(), [this, &function](uint32_t handle)
+                    {
+                        function(books.rowOf(handle));
+                    });
+                    break;
+                case BookQuery::AND:
+                    {
+                        const BookQuery *driver = nullptr;
+                        size_t smallest = 0;
+                        for(const auto &child : query.getChildren())
+                        {
+                            if(isIndexed(child))
+                            {
+                                size_t size = estimate(child);
+                                if(!driver || size < smallest)
+                                {
+                                    driver = &child;
+                                    smallest = size;
+                                }
+                            }
+                        }
+                        visitCandidates(*driver, function);
+                        break;
+                    }
+                case BookQuery::OR:
+                    {
+                        const auto &children = query.getChildren();
+                        for(size_t i = 0; i < children.size(); ++i)
+                        {
+                            visitCandidates(children[i], [this, &children, i, &function](size_t position)
+                            {
+                                for(size_t j = 0; j < i; ++j)
+                                {
+                                    if(children[j].matches(BookRef(&books, position)))
+                                    {
+                                        return;
+                                    }
+                                }
+                                function(position);
+                            });
+                        }
+                        break;
+                    }
+                default:
+                    break;
+            }
+        }
+
+        // Call function(row) for every book matching a query, in catalog order
+        template<typename F>
+        void forEachMatch(const BookQuery &query, F function) const
+        {
+            // Everything: no mask or candidate list needed
+            if(query.getKind() == BookQuery::AND && query.getChildren().empty())
+            {
+                for(size_t row = 0; row < books.size(); ++row)
+                {
+                    function(row);
+                }
+                return;
+            }
+
+            if(shouldScan(query))
+            {
+                std::vector<uint8_t> mask(books.size(), 1);
+                filterRows(query, mask);
+                for(size_t row = 0; row < mask.size(); ++row)
+                {
+                    if(mask[row])
+                    {
+                        function(row);
+                    }
+                }
+                return;
+            }
+
+            std::vector<size_t> positions;
+            visitCandidates(query, [this, &query, &positions](size_t position)
+            {
+                if(query.matches(BookRef(&books, position)))
+                {
+                    positions.push_back(position);
+                }
+            });
+            std::sort(positions.begin(), positions.end());
+
+            for(size_t position : positions)
+            {
+                function(position);
+            }
+        }
+
+        // Copy out the books of a list of handles, keeping its order. Lookups hand out copies taken under the
+        // catalog lock, as the rows may move or change as soon as it is released.
+        std::vector<Book> resolveBooks(const std::vector<uint32_t> &handles) const
+        {
+            std::vector<Book> foundBooks;
+
+            foundBooks.reserve(handles.size());
+            for(uint32_t handle : handles)
+            {
+                foundBooks.push_back(books.get(books.rowOf(handle)));
+            }
+            return foundBooks;
+        }
+
+        // Copy out the books stored under a key of a secondary index, in catalog order
+        std::vector<Book> lookupIndex(const ValueIndex &index, const string &key) const
+        {
+            std::vector<Book> foundBooks;
+            auto it = index.find(key);
+
+            if(it == index.end())
+            {
+                return foundBooks;
+            }
+
+            std::vector<size_t> positions;
+            positions.reserve(it->second.size());
+            for(uint32_t handle : it->second)
+            {
+                positions.push_back(books.rowOf(handle));
+            }
+            std::sort(positions.begin(), positions.end());
+
+            foundBooks.reserve(positions.size());
+            for(size_t position : positions)
+            {
+                foundBooks.push_back(books.get(position));
+            }
+            return foundBooks;
+        }
+
+        // Add a book record at the end of the catalog and index it
+        void storeBook(const Book &book)
+        {
+            uint32_t handle = internBook(book.getId());
+
+            books.push(handle, book);
+            indexBook(books.size() - 1);
+            bookSegments.add(handle);
+        }
+
+        // Add a book at the end of the catalog without indexing it yet (batch inserts index their rows together);
+        // returns its row
+        size_t storeBookCopy(StringRef bookID, StringRef title, StringRef author, const string &genre, int year, int quantity)
+        {
+            uint32_t handle = internBook(bookID);
+
+            books.pushCopy(handle, bookID, title, author, genre, year, quantity);
+            bookSegments.add(handle);
+            return books.size() - 1;
+        }
+
+        // Add a book row loaded from a segment of the book file; its strings point into the file, held by the book store.
+        // Loaded rows are indexed in bulk afterwards (indexBooksFrom).
+        void storeBookRow(StringRef bookID, StringRef title, StringRef author, const string &genre, int year, int quantity, uint32_t segment)
+        {
+            uint32_t handle = internBook(bookID);
+
+            books.push(handle, bookID, title, author, genre, year, quantity);
+            bookSegments.add(handle, segment);
+        }
+
+        // Add a reader record at the end of the reader list and index its loans
+        // (segment is the file segment it was loaded from, or NO_SEGMENT for a new reader)
+        void storeReader(const Reader &reader, uint32_t segment = SegmentMap::NO_SEGMENT)
+        {
+            uint32_t handle = internReader(reader.getId());
+
+            readerPositions[handle] = readers.size();
+            readerHandles.push_back(handle);
+            readers.push_back(reader);
+            indexLoans(handle, reader);
+            readerSegments.add(handle, segment);
+        }
+
+        // Encode the books of one file segment column by column; returns how many were written
+        static uint32_t encodeBookSegment(const std::vector<Book> &members, ByteWriter &file)
+        {
+            ColumnCodec::writeStrings(file, members.size(), [&members](size_t i) -> const string & { return members[i].getId(); });
+            ColumnCodec::writeStrings(file, members.size(), [&members](size_t i) -> const string & { return members[i].getTitle(); });
+            ColumnCodec::writeDictionary(file, members.size(), [&members](size_t i) -> const string & { return members[i].getAuthor(); });
+            ColumnCodec::writeDictionary(file, members.size(), [&members](size_t i) -> const string & { return members[i].getGenre(); });
+            ColumnCodec::writeInts(file, members.size(), [&members](size_t i) { return members[i].getYear(); });
+            ColumnCodec::writeInts(file, members.size(), [&members](size_t i) { return members[i].getQuantity(); });
+            ColumnCodec::writeFlags(file, members.size(), [&members](size_t i) { return members[i].getIsAvailable(); });
+            return static_cast<uint32_t>(members.size());
+        }
+
+        // Encode the readers of one file segment column by column, loans as one column of book IDs; returns how many were written
+        static uint32_t encodeReaderSegment(const SavedReaders &members, ByteWriter &file)
+        {
+            ColumnCodec::writeStrings(file, members.ids.size(), [&members](size_t i) -> const string & { return members.ids[i]; });
+            ColumnCodec::writeStrings(file, members.names.size(), [&members](size_t i) -> const string & { return members.names[i]; });
+            ColumnCodec::writeInts(file, members.loanCounts.size(), [&members](size_t i) { return members.loanCounts[i]; });
+            ColumnCodec::writeStrings(file, members.loans.size(), [&members](size_t i) -> const string & { return members.loans[i]; });
+            return static_cast<uint32_t>(members.ids.size());
+        }
+
+        // Copy the records of the segments a save encodes (changed ones, new ones past the end of the file's table,
+        // or all of them for a rewrite), so they can be encoded while the library goes on changing
+        void copySavedRecords(bool rewritingBooks, bool rewritingReaders)
+        {
+            const std::vector<uint8_t> &dirtyBooks = bookSegments.dirtyFlags();
+            savedBooks.assign(bookSegments.size(), std::vector<Book>());
+            for(uint32_t segment = 0; segment < bookSegments.size(); ++segment)
+            {
+                if(!rewritingBooks && segment < bookSnapshot.segmentCount() && !dirtyBooks[segment])
+                {
+                    continue;
+                }
+
+                // A segment can be dirty from a new book alone, with its older books still only in the file
+                loadBookSegment(segment);
+                const std::vector<uint32_t> &handles = bookSegments.membersOf(segment);
+                savedBooks[segment].reserve(handles.size());
+                for(uint32_t handle : handles)
+                {
+                    savedBooks[segment].push_back(books.get(books.rowOf(handle)));
+                }
+            }
+
+            const std::vector<uint8_t> &dirtyReaders = readerSegments.dirtyFlags();
+            savedReaders.assign(readerSegments.size(), SavedReaders());
+            for(uint32_t segment = 0; segment < readerSegments.size(); ++segment)
+            {
+                if(!rewritingReaders && segment < readerSnapshot.segmentCount() && !dirtyReaders[segment])
+                {
+                    continue;
+                }
+
+                SavedReaders &saved = savedReaders[segment];
+                for(uint32_t handle : readerSegments.membersOf(segment))
+                {
+                    const Reader &reader = readers[readerPositions[handle]];
+                    saved.ids.push_back(reader.getId());
+                    saved.names.push_back(reader.getName());
+                    saved.loanCounts.push_back(static_cast<int64_t>(reader.getBorrowedBooks().size()));
+                    for(uint32_t bookHandle : reader.getBorrowedBooks())
+                    {
+                        saved.loans.push_back(bookIds.name(bookHandle));
+                    }
+                }
+            }
+        }
+
+        // Find reader by ID
+        Reader* findReader(const string &readerID)
+        {
+            uint32_t handle = findReaderHandle(readerID);
+
+            if(handle != IdDictionary::NO_HANDLE)
+            {
+                return &readers[readerPositions[handle]];
+            }
+            return nullptr;
+        }
+
+        // Find the row of a book by ID with its full record decoded, or NO_ROW
+        size_t findBookRow(const string &bookID)
+        {
+            uint32_t handle = findBookHandle(bookID);
+
+            if(handle != IdDictionary::NO_HANDLE)
+            {
+                return loadedRowOf(handle);
+            }
+            return BookStore::NO_ROW;
+        }
+
+        // Helper functions for saving library data to file
+        // Write int, bool data to file
+        template<typename Writer, typename T>
+        void writeData(Writer &file, const T &data)
+        {
+            file.write(data);
+        }
+
+        // Write string data to file
+        template<typename Writer>
+        void writeStringData(Writer &file, const string &data)
+        {
+            int size = static_cast<int>(data.size());
+            writeData(file, size);
+            file.write(data.data(), size);
+        }
+
+        template<typename Writer>
+        void writeStringData(Writer &file, StringRef data)
+        {
+            int size = static_cast<int>(data.size());
+            writeData(file, size);
+            file.write(data.data(), size);
+        }
+
+        // Helper functions for loading library data from a file mapped into memory
+        // Read int, bool data from file
+        template<typename T>
+        static bool readData(ByteReader &file, T &data)
+        {
+            return file.read(data);
+        }
+
+        // Read string data from file, pointing into the file instead of copying
+        static bool readStringData(ByteReader &file, StringRef &data)
+        {
+            int size;
+
+            if (!file.read(size) || size < 0 || size > 1000000)
+            {
+                return false;
+            }
+            return file.take(size, data);
+        }
+
+        static bool readStringData(ByteReader &file, string &data)
+        {
+            StringRef chars;
+
+            if (!readStringData(file, chars))
+            {
+                return false;
+            }
+            data.assign(chars.data(), chars.size());
+            return true;
+        }
+
+        // Decoded columns of a run of book records; strings point into the loaded file
+        struct BookColumns
+        {
+            std::vector<StringRef> ids, titles;
+            std::vector<StringRef> authors, genres;         // distinct values, picked by the codes below
+            std::vector<uint32_t> authorCodes, genreCodes;
+            std::vector<int> years, quantities;
+            std::vector<uint8_t> available;
+        };
+
+        // Decoded columns of a run of reader records
+        struct ReaderColumns
+        {
+            std::vector<StringRef> ids, names;
+            std::vector<int> loanCounts;
+            std::vector<StringRef> loans;   // borrowed book IDs of all the readers, in reader order
+        };
+
+        // Decode count books stored column by column (file format version 2)
+        static bool decodeBookColumns(ByteReader &file, uint32_t count, BookColumns &columns)
+        {
+            return ColumnCodec::readStrings(file, count, columns.ids) &&
+                   ColumnCodec::readStrings(file, count, columns.titles) &&
+                   ColumnCodec::readDictionary(file, count, columns.authors, columns.authorCodes) &&
+                   ColumnCodec::readDictionary(file, count, columns.genres, columns.genreCodes) &&
+                   ColumnCodec::readInts(file, count, columns.years) &&
+                   ColumnCodec::readInts(file, count, columns.quantities) &&
+                   ColumnCodec::readFlags(file, count, columns.available);
+        }
+
+        // Decode only the IDs of count books stored column by column, leaving the other fields empty (lazy loading)
+        static bool decodeBookIds(ByteReader &file, uint32_t count, BookColumns &columns)
+        {
+            columns.titles.assign(count, StringRef());
+            columns.authors.assign(1, StringRef());
+            columns.genres.assign(1, StringRef());
+            columns.authorCodes.assign(count, 0);
+            columns.genreCodes.assign(count, 0);
+            columns.years.assign(count, 0);
+            columns.quantities.assign(count, 0);
+            columns.available.assign(count, 0);
+            return ColumnCodec::readStrings(file, count, columns.ids);
+        }
+
+        // Decode count books stored record by record (legacy files and file format version 1)
+        static bool decodeBookRecords(ByteReader &file, uint32_t count, BookColumns &columns)
+        {
+            columns.ids.resize(count);
+            columns.titles.resize(count);
+            columns.authors.resize(count);
+            columns.genres.resize(count);
+            columns.authorCodes.resize(count);
+            columns.genreCodes.resize(count);
+            columns.years.resize(count);
+            columns.quantities.resize(count);
+            columns.available.resize(count);
+
+            for(uint32_t i = 0; i < count; ++i)
+            {
+                if (!readStringData(file, columns.ids[i]) ||
+                    !readStringData(file, columns.titles[i]) ||
+                    !readStringData(file, columns.authors[i]) ||
+                    !readStringData(file, columns.genres[i]) ||
+                    !readData(file, columns.years[i]) ||
+                    !readData(file, columns.quantities[i]) ||
+                    !readData(file, columns.available[i]))
+                {
+                    return false;
+                }
+                columns.authorCodes[i] = i;
+                columns.genreCodes[i] = i;
+            }
+            return true;
+        }
+
+        // Decode count readers stored column by column (file format version 2)
+        static bool decodeReaderColumns(ByteReader &file, uint32_t count, ReaderColumns &columns)
+        {
+            size_t loanCount = 0;
+
+            if (!ColumnCodec::readStrings(file, count, columns.ids) ||
+                !ColumnCodec::readStrings(file, count, columns.names) ||
+                !ColumnCodec::readInts(file, count, columns.loanCounts))
+            {
+                return false;
+            }
+            for(int borrowedCount : columns.loanCounts)
+            {
+                if (borrowedCount < 0 || static_cast<size_t>(borrowedCount) > file.remaining())
+                {
+                    return false;
+                }
+                loanCount += borrowedCount;
+            }
+            return loanCount <= file.remaining() && ColumnCodec::readStrings(file, loanCount, columns.loans);
+        }
+
+        // Decode count readers stored record by record (legacy files and file format version 1)
+        static bool decodeReaderRecords(ByteReader &file, uint32_t count, ReaderColumns &columns)
+        {
+            columns.ids.resize(count);
+            columns.names.resize(count);
+            columns.loanCounts.resize(count);
+            columns.loans.clear();
+
+            for(uint32_t i = 0; i < count; ++i)
+            {
+                uint32_t borrowedCount;
+
+                // Every borrowed book ID takes at least 4 bytes
+                if (!readStringData(file, columns.ids[i]) ||
+                    !readStringData(file, columns.names[i]) ||
+                    !readData(file, borrowedCount) ||
+                    borrowedCount > file.remaining() / 4)
+                {
+                    return false;
+                }
+
+                columns.loanCounts[i] = static_cast<int>(borrowedCount);
+                for(uint32_t j = 0; j < borrowedCount; ++j)
+                {
+                    StringRef bookID;
+                    if (!readStringData(file, bookID))
+                    {
+                        return false;
+                    }
+                    columns.loans.push_back(bookID);
+                }
+            }
+            return true;
+        }
+
+        // Add decoded books to the catalog as members of a file segment (without indexing them yet)
+        void storeBooks(const BookColumns &columns, uint32_t segment)
+        {
+            std::vector<string> genres(columns.genres.begin(), columns.genres.end());
+
+            for(size_t i = 0; i < columns.ids.size(); ++i)
+            {
+                storeBookRow(columns.ids[i], columns.titles[i], columns.authors[columns.authorCodes[i]], genres[columns.genreCodes[i]],
+                             columns.years[i], columns.quantities[i], segment);
+            }
+        }
+
+        // Add decoded readers to the reader list as members of a file segment
+        void storeReaders(const ReaderColumns &columns, uint32_t segment)
+        {
+            size_t nextLoan = 0;
+
+            for(size_t i = 0; i < columns.ids.size(); ++i)
+            {
+                std::vector<uint32_t> borrowedBooks;
+                borrowedBooks.reserve(columns.loanCounts[i]);
+                for(int j = 0; j < columns.loanCounts[i]; ++j)
+                {
+                    borrowedBooks.push_back(internBook(columns.loans[nextLoan++]));
+                }
+                storeReader(Reader(columns.ids[i], columns.names[i], borrowedBooks), segment);
+            }
+        }
+
+        // Check and decode the segments of a loaded file on all cores, then store them in file order.
+        // This goes a batch of segments at a time, so only a bounded number of decoded segments is held at once.
+        template<typename Columns, typename Decode, typename Store>
+        static bool loadSegments(const SegmentedFile &snapshot, const char *data, Decode decode, Store store)
+        {
+            size_t batchSize = Parallel::threadCount() * 8;
+
+            for(size_t first = 0; first < snapshot.segmentCount(); first += batchSize)
+            {
+                size_t count = (std::min)(batchSize, snapshot.segmentCount() - first);
+                std::vector<Columns> decoded(count);
+                std::vector<uint8_t> intact(count, 0);
+
+                Parallel::forEach(count, [&](size_t i)
+                {
+                    StringRef bytes;
+                    if (snapshot.readSegment(data, first + i, bytes))
+                    {
+                        ByteReader file(bytes.data(), bytes.size());
+                        intact[i] = decode(file, snapshot.segment(first + i).count, decoded[i]);
+                    }
+                });
+
+                for(size_t i = 0; i < count; ++i)
+                {
+                    if (!intact[i])
+                    {
+                        return false;
+                    }
+                    store(decoded[i], static_cast<uint32_t>(first + i));
+                }
+            }
+            return true;
+        }
+
+        // Read every book of a book file, in segmented or legacy layout, and index them.
+        // Lazily, only the IDs of a column-encoded file are read; the rest is decoded segment by segment on first use.
+        bool loadBooks(const char *bookFileName, const std::shared_ptr<const MappedFile> &data, bool lazy)
+        {
+            size_t firstRow = books.size();
+            lazy = lazy && firstRow == 0;
+            bool loaded = storeBookFile(bookFileName, *data, lazy);
+
+            if(lazy && loaded && bookSnapshot.version() > 1)
+            {
+                lazyBookFile = data;
+                lazySegments.clear();
+                for(size_t segment = 0; segment < bookSnapshot.segmentCount(); ++segment)
+                {
+                    lazySegments.push_back(bookSnapshot.segment(segment));
+                }
+                segmentDecoded.assign(lazySegments.size(), 0);
+                segmentPristine.assign(lazySegments.size(), 1);
+                segmentLastUse = std::vector<std::atomic<uint64_t>>(lazySegments.size());
+                return true;
+            }
+
+            // Books stored before a failure stay in the catalog, so they are indexed either way
+            std::vector<size_t> rows;
+            for(size_t row = firstRow; row < books.size(); ++row)
+            {
+                rows.push_back(row);
+            }
+            indexBooks(rows);
+            return loaded;
+        }
+
+        bool storeBookFile(const char *bookFileName, const MappedFile &data, bool lazy)
+        {
+            if (SegmentedFile::isSegmented(data.data(), data.size()))
+            {
+                if (!bookSnapshot.open(bookFileName, data.data(), data.size()))
+                {
+                    cout << "Error: Book file is damaged or from a newer version.\n";
+                    return false;
+                }
+
+                uint64_t bookCount = bookSnapshot.recordCount();
+                cout << "Loading " << bookCount << " books from file.\n";
+                books.reserve(books.size() + bookCount);
+                bookIds.reserve(books.size() + bookCount);
+
+                auto decode = bookSnapshot.version() == 1 ? decodeBookRecords : (lazy ? decodeBookIds : decodeBookColumns);
+                if (!loadSegments<BookColumns>(bookSnapshot, data.data(), decode, [this](const BookColumns &columns, uint32_t segment)
+                {
+                    storeBooks(columns, segment);
+                }))
+                {
+                    cout << "Error: Failed to read book data.\n";
+                    return false;
+                }
+                return true;
+            }
+
+            // Legacy layout: a record count followed by the records, which have no offsets to split them by.
+            // They go into new segments, saved on the next save.
+            ByteReader inBookFile(data.data(), data.size());
+            uint32_t bookCount;
+            if (!readData(inBookFile, bookCount))
+            {
+                cout << "Error: Failed to read book count.\n";
+                return false;
+            }
+            cout << "Loading " << bookCount << " books from file.\n";
+
+            // Every legacy book record takes at least 25 bytes
+            if (bookCount > inBookFile.remaining() / 25)
+            {
+                cout << "Error: Book count is invalid, possible file corruption.\n";
+                return false;
+            }
+
+            books.reserve(books.size() + bookCount);
+            bookIds.reserve(books.size() + bookCount);
+
+            BookColumns columns;
+            for(uint32_t first = 0; first < bookCount; first += SegmentMap::CAPACITY)
+            {
+                if (!decodeBookRecords(inBookFile, (std::min)(SegmentMap::CAPACITY, bookCount - first), columns))
+                {
+                    cout << "Error: Failed to read book data.\n";
+                    return false;
+                }
+                storeBooks(columns, SegmentMap::NO_SEGMENT);
+            }
+            return true;
+        }
+
+        // Read every reader of a reader file, in segmented or legacy layout
+        bool loadReaders(const char *readerFileName, const MappedFile &data)
+        {
+            if (SegmentedFile::isSegmented(data.data(), data.size()))
+            {
+                if (!readerSnapshot.open(readerFileName, data.data(), data.size()))
+                {
+                    cout << "Error: Reader file is damaged or from a newer version.\n";
+                    return false;
+                }
+
+                uint64_t readerCount = readerSnapshot.recordCount();
+                cout << "Loading " << readerCount << " readers from file.\n";
+                readers.reserve(readers.size() + readerCount);
+                readerHandles.reserve(readers.size() + readerCount);
+                readerIds.reserve(readers.size() + readerCount);
+
+                auto decode = readerSnapshot.version() > 1 ? decodeReaderColumns : decodeReaderRecords;
+                if (!loadSegments<ReaderColumns>(readerSnapshot, data.data(), decode, [this](const ReaderColumns &columns, uint32_t segment)
+                {
+                    storeReaders(columns, segment);
+                }))
+                {
+                    cout << "Error: Failed to read reader data.\n";
+                    return false;
+                }
+                return true;
+            }
+
+            ByteReader inReaderFile(data.data(), data.size());
+            uint32_t readerCount;
+            if (!readData(inReaderFile, readerCount))
+            {
+                cout << "Error: Failed to read reader count.\n";
+                return false;
+            }
+            cout << "Loading " << readerCount << " readers from file.\n";
+
+            // Every legacy reader record takes at least 12 bytes
+            if (readerCount > inReaderFile.remaining() / 12)
+            {
+                cout << "Error: Reader count is invalid, possible file corruption.\n";
+                return false;
+            }
+
+            readers.reserve(readers.size() + readerCount);
+            readerHandles.reserve(readers.size() + readerCount);
+            readerIds.reserve(readers.size() + readerCount);
+
+            ReaderColumns columns;
+            for(uint32_t first = 0; first < readerCount; first += SegmentMap::CAPACITY)
+            {
+                if (!decodeReaderRecords(inReaderFile, (std::min)(SegmentMap::CAPACITY, readerCount - first), columns))
+                {
+                    cout << "Error: Failed to read reader data.\n";
+                    return false;
+                }
+                storeReaders(columns, SegmentMap::NO_SEGMENT);
+            }
+            return true;
+        }
+
+        // Append a change to the journal and wait until it is on disk (nothing to do while replaying it).
+        // Without waiting, the caller waits with waitLogged once it has let go of its locks, so changes from
+        // several threads share one sync. Returns the record's sequence number, or 0 if nothing was logged.
+        uint64_t logOperation(JournalOperation operation, const ByteWriter &record, bool wait = true)
+        {
+            if(replaying || !journal.isOpen())
+            {
+                return 0;
+            }
+
+            uint64_t sequence = journal.append(operation, record.data(), record.size());
+            if(sequence == 0)
+            {
+                cout << "Error: Change is too large to be written to the journal.\n";
+                return 0;
+            }
+            if(wait)
+            {
+                waitLogged(sequence);
+            }
+            return sequence;
+        }
+
+        // Wait until a logged change is on disk
+        void waitLogged(uint64_t sequence)
+        {
+            if(sequence != 0 && !journal.waitDurable(sequence))
+            {
+                cout << "Error: Failed to write journal.\n";
+            }
+        }
+
+        // Redo one journaled change; false if the record cannot be decoded
+        bool applyJournalRecord(uint8_t operation, ByteReader &record)
+        {
+            string bookID, readerID, text, title, author, genre;
+            int year, quantity;
+            bool isAvailable;
+            uint32_t count;
+
+            switch(operation)
+            {
+                case LOG_APPEND_BOOK:
+                {
+                    if(!readStringData(record, bookID) || !readStringData(record, title) || !readStringData(record, author) ||
+                       !readStringData(record, genre) || !readData(record, year) || !readData(record, quantity) || !readData(record, isAvailable))
+                    {
+                        return false;
+                    }
+
+                    if(findBookHandle(bookID) != IdDictionary::NO_HANDLE)
+                    {
+                        cout << "Warning: Book " << bookID << " from the journal already exists, skipped.\n";
+                        return true;
+                    }
+
+                    Book book;
+                    book.setId(bookID);
+                    book.setTitle(title);
+                    book.setAuthor(author);
+                    book.setGenre(genre);
+                    book.setYear(year);
+                    book.setQuantity(quantity);
+                    book.setIsAvailable(isAvailable);
+                    storeBook(book);
+                    return true;
+                }
+                case LOG_APPEND_READER:
+                {
+                    if(!readStringData(record, readerID) || !readStringData(record, text) || !readData(record, count))
+                    {
+                        return false;
+                    }
+
+                    Reader reader;
+                    reader.setId(readerID);
+                    reader.setName(text);
+                    for(uint32_t i = 0; i < count; ++i)
+                    {
+                        if(!readStringData(record, bookID))
+                        {
+                            return false;
+                        }
+                        reader.appendBorrowedBook(internBook(bookID));
+                    }
+
+                    if(findReaderHandle(readerID) != IdDictionary::NO_HANDLE)
+                    {
+                        cout << "Warning: Reader " << readerID << " from the journal already exists, skipped.\n";
+                        return true;
+                    }
+                    storeReader(reader);
+                    return true;
+                }
+                case LOG_APPEND_BOOKS:
+                {
+                    std::vector<size_t> rows;
+                    bool intact = true;
+
+                    while(record.remaining() > 0)
+                    {
+                        StringRef id, bookTitle, bookAuthor;
+                        if(!readStringData(record, id) || !readStringData(record, bookTitle) || !readStringData(record, bookAuthor) ||
+                           !readStringData(record, genre) || !readData(record, year) || !readData(record, quantity) || !readData(record, isAvailable))
+                        {
+                            intact = false;
+                            break;
+                        }
+
+                        if(findBookHandle(id.str()) != IdDictionary::NO_HANDLE)
+                        {
+                            cout << "Warning: Book " << id.str() << " from the journal already exists, skipped.\n";
+                            continue;
+                        }
+                        rows.push_back(storeBookCopy(id, bookTitle, bookAuthor, genre, year, quantity));
+                    }
+                    indexBooks(rows);
+                    return intact;
+                }
+                case LOG_BATCH_PART:
+                    return readBatchOperations(record, replayedBatch);
+                case LOG_BATCH:
+                {
+                    std::vector<BatchOperation> operations;
+                    operations.swap(replayedBatch);
+                    if(!readBatchOperations(record, operations))
+                    {
+                        return false;
+                    }
+
+                    // Only applied operations were logged, so they all apply again
+                    BatchReport report;
+                    return applyBatch(operations, BATCH_EACH, report);
+                }
+                case LOG_EDIT_TITLE:
+                    return readStringData(record, bookID) && readStringData(record, text) && editBookTitle(bookID, text);
+                case LOG_EDIT_AUTHOR:
+                    return readStringData(record, bookID) && readStringData(record, text) && editBookAuthor(bookID, text);
+                case LOG_EDIT_GENRE:
+                    return readStringData(record, bookID) && readStringData(record, text) && editBookGenre(bookID, text);
+                case LOG_EDIT_YEAR:
+                    return readStringData(record, bookID) && readData(record, year) && editBookYear(bookID, year);
+                case LOG_EDIT_DETAIL:
+                    return readStringData(record, bookID) && readStringData(record, title) && readStringData(record, author) &&
+                           readStringData(record, genre) && readData(record, year) && readData(record, quantity) &&
+                           editBookDetail(bookID, title, author, genre, year, quantity);
+                case LOG_EDIT_READER_NAME:
+                    return readStringData(record, readerID) && readStringData(record, text) && editReaderName(readerID, text);
+                case LOG_BORROW:
+                    return readStringData(record, bookID) && readStringData(record, readerID) && borrowBook(bookID, readerID);
+                case LOG_RETURN:
+                    return readStringData(record, bookID) && readStringData(record, readerID) && returnBook(bookID, readerID);
+                case LOG_DELETE_BOOK:
+                    return readStringData(record, bookID) && deleteBook(bookID);
+                case LOG_DELETE_READER:
+                    return readStringData(record, readerID) && deleteReader(readerID);
+            }
+            return false;
+        }
+
+        // Redo the reader side of one journaled change whose book side is already in the loaded book file
+        // (the book file of a save was committed but its reader file was not); false if it cannot be applied
+        bool applyJournalRecordToReaders(uint8_t operation, ByteReader &record)
+        {
+            string bookID, readerID;
+
+            switch(operation)
+            {
+                case LOG_APPEND_READER:
+                case LOG_EDIT_READER_NAME:
+                    return applyJournalRecord(operation, record);
+                case LOG_BORROW:
+                    return readStringData(record, bookID) && readStringData(record, readerID) && replayReaderLoan(true, bookID, readerID);
+                case LOG_RETURN:
+                    return readStringData(record, bookID) && readStringData(record, readerID) && replayReaderLoan(false, bookID, readerID);
+                case LOG_DELETE_READER:
+                {
+                    if(!readStringData(record, readerID))
+                    {
+                        return false;
+                    }
+
+                    uint32_t handle = findReaderHandle(readerID);
+                    if(handle == IdDictionary::NO_HANDLE)
+                    {
+                        return false;
+                    }
+                    removeReader(handle, false);
+                    return true;
+                }
+                case LOG_BATCH_PART:
+                    return readBatchOperations(record, replayedBatch);
+                case LOG_BATCH:
+                {
+                    std::vector<BatchOperation> operations;
+                    operations.swap(replayedBatch);
+                    if(!readBatchOperations(record, operations))
+                    {
+                        return false;
+                    }
+
+                    bool applied = true;
+                    for(const BatchOperation &batchOperation : operations)
+                    {
+                        if(batchOperation.getKind() == BatchOperation::BORROW || batchOperation.getKind() == BatchOperation::RETURN)
+                        {
+                            applied = replayReaderLoan(batchOperation.getKind() == BatchOperation::BORROW,
+                                                       batchOperation.getBookId(), batchOperation.getReaderId()) && applied;
+                        }
+                    }
+                    return applied;
+                }
+            }
+
+            // Everything else only changes books
+            return true;
+        }
+
+        // Record or drop a loan on the reader's side only, leaving the book's copies as loaded
+        bool replayReaderLoan(bool borrow, const string &bookID, const string &readerID)
+        {
+            uint32_t readerHandle = findReaderHandle(readerID);
+            if(readerHandle == IdDictionary::NO_HANDLE)
+            {
+                return false;
+            }
+
+            uint32_t bookHandle = internBook(bookID);
+            Reader &reader = readers[readerPositions[readerHandle]];
+            if(borrow)
+            {
+                reader.appendBorrowedBook(bookHandle);
+                addBorrower(bookHandle, readerHandle);
+            }
+            else
+            {
+                if(!hasBorrower(bookHandle, readerHandle))
+                {
+                    return false;
+                }
+                reader.deleteBorrowedBooks(bookHandle);
+                removeBorrower(bookHandle, readerHandle);
+            }
+            readerSegments.touch(readerHandle);
+            return true;
+        }
+
+        // Parse a whole string as a decimal int
+        static bool parseInt(const string &text, int &value)
+        {
+            size_t position = (!text.empty() && (text[0] == '-' || text[0] == '+')) ? 1 : 0;
+            long long parsed = 0;
 
-            if(it != readers.end())
+            if(position == text.size())
             {
-                return &(*it);
+                return false;
             }
-            return nullptr;
+            for(; position < text.size(); ++position)
+            {
+                if(text[position] < '0' || text[position] > '9')
+                {
+                    return false;
+                }
+                parsed = parsed * 10 + (text[position] - '0');
+                if(parsed > INT_MAX)
+                {
+                    return false;
+                }
+            }
+            value = static_cast<int>(text[0] == '-' ? -parsed : parsed);
+            return true;
         }
 
-        // Find book by ID
-        Book* findBook(const string &bookID)
+        // Parse a yes/no value the way feeds tend to write it
+        static bool parseFlag(const string &text, bool &value)
         {
-            auto it = std::find_if(books.begin(), books.end(), [&bookID](Book &book)
+            string lowered;
+            for(char character : text)
             {
-                return book.getId() == bookID;
-            });
+                lowered += static_cast<char>(std::tolower(static_cast<unsigned char>(character)));
+            }
 
-            if(it != books.end())
+            if(lowered == "true" || lowered == "yes" || lowered == "y" || lowered == "1")
             {
-                return &(*it);
+                value = true;
+                return true;
             }
-            return nullptr;
+            if(lowered == "false" || lowered == "no" || lowered == "n" || lowered == "0")
+            {
+                value = false;
+                return true;
+            }
+            return false;
         }
 
-        // Helper functions for saving library data to file
-        // Write int, bool data to file
-        template<typename T>
-        void writeData(std::ofstream &file, const T &data)
+        // Check a record of an import feed and add the book to the catalog and to the batch's journal record,
+        // without indexing it yet. Returns why the record was rejected, or an empty string.
+        string importBook(const FeedRecord &record, ByteWriter &batch, std::vector<size_t> &rows)
         {
-            file.write(reinterpret_cast<const char*>(&data), sizeof(data));
-        }
+            const string &bookID = record.values[FEED_ID];
+            int year, quantity;
+            bool isAvailable = true;
 
-        // Write string data to file
-        void writeStringData(std::ofstream &file, const string &data)
-        {
-            int size = static_cast<int>(data.size());
-            writeData(file, size);
-            file.write(data.c_str(), size);
-        }
+            if(bookID.empty())
+            {
+                return "empty book ID";
+            }
+            if(findBookHandle(bookID) != IdDictionary::NO_HANDLE)
+            {
+                return "book ID " + bookID + " already exists";
+            }
+            if(!parseInt(record.values[FEED_YEAR], year) || year < 0)
+            {
+                return "invalid year \"" + record.values[FEED_YEAR] + "\"";
+            }
+            if(!parseInt(record.values[FEED_QUANTITY], quantity) || quantity < 0)
+            {
+                return "invalid quantity \"" + record.values[FEED_QUANTITY] + "\"";
+            }
+            if(record.present[FEED_AVAILABLE] && !record.values[FEED_AVAILABLE].empty() &&
+               !parseFlag(record.values[FEED_AVAILABLE], isAvailable))
+            {
+                return "invalid availability \"" + record.values[FEED_AVAILABLE] + "\"";
+            }
 
-        // Helper functions for loading library data from file
-        // Read int, bool data from file
-        template<typename T>
-        bool readData(std::ifstream &file, T &data)
-        {
-            file.read(reinterpret_cast<char*>(&data), sizeof(data));
-            return !file.fail();
+            const string &title = record.values[FEED_TITLE];
+            const string &author = record.values[FEED_AUTHOR];
+            rows.push_back(storeBookCopy(StringRef(bookID.data(), bookID.size()), StringRef(title.data(), title.size()),
+                                         StringRef(author.data(), author.size()), record.values[FEED_GENRE], year, quantity));
+
+            writeStringData(batch, bookID);
+            writeStringData(batch, title);
+            writeStringData(batch, author);
+            writeStringData(batch, record.values[FEED_GENRE]);
+            writeData(batch, year);
+            writeData(batch, quantity);
+            writeData(batch, isAvailable);
+            return string();
         }
 
-        // Read string data from file
-        bool readStringData(std::ifstream &file, string &data)
+        // Create an export file in the format its extension names
+        bool openExport(FeedWriter &feed, const char *exportFileName, const std::vector<string> &columns)
         {
-            int size;
-            
-            if (!readData(file, size))
+            FeedReader::Format format;
+
+            if(!FeedReader::formatOf(exportFileName, format))
             {
+                cout << "Error: Unknown export format, expected a .csv or .jsonl file.\n";
                 return false;
             }
-
-            if (size < 0 || size > 1000000)
+            if(!feed.open(exportFileName, format, columns))
             {
+                cout << "Error: Failed to create export file.\n";
                 return false;
             }
+            return true;
+        }
 
-            std::vector<char> buffer(size);
-            file.read(&buffer[0], size); 
-            if (file.fail())
+        // Put a written export in place and fill in the rest of its report
+        bool finishExport(FeedWriter &feed, std::chrono::steady_clock::time_point started, ExportReport &report)
+        {
+            report.bytes = feed.bytesWritten();
+            if(!feed.finish())
             {
+                cout << "Error: Failed to write export file.\n";
                 return false;
             }
-            data.assign(buffer.begin(), buffer.end());
-
+            report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
             return true;
         }
+
+        // Index a batch of imported books and journal it as one record; returns the record's sequence number for
+        // waitLogged (0 if there was nothing to journal)
+        uint64_t finishImportBatch(std::vector<size_t> &rows, ByteWriter &batch)
+        {
+            if(rows.empty())
+            {
+                return 0;
+            }
+            indexBooks(rows);
+            uint64_t logged = logOperation(LOG_APPEND_BOOKS, batch, false);
+            rows.clear();
+            batch.clear();
+            return logged;
+        }
+
         public:
         Library(){};
 
-        Library(const std::vector<Book> &books, const std::vector<Reader> &readers)
-            : books(books), readers(readers) {};
+        Library(const Library &) = delete;
+        Library &operator=(const Library &) = delete;
+
+        // Queued asynchronous saves and loads are run, and a save still running in the background is waited for
+        ~Library()
+        {
+            io.stop();
+            finishSave();
+        }
 
         // Check if book ID exists
         bool isBookIdExist(const string &bookID)
         {
-            return findBook(bookID) != nullptr;
+            SharedLock lock(catalogMutex);
+            return findBookHandle(bookID) != IdDictionary::NO_HANDLE;
         }
 
         // Check if reader ID exists
         bool isReaderIdExist(const string &readerID)
         {
+            SharedLock lock(catalogMutex);
             return findReader(readerID) != nullptr;
         }
 
         // Add a book to the library
         void appendBook(const Book &book)
         {
+            ExclusiveLock lock(catalogMutex);
             cout << "Appending book: " << book.getTitle() << '\n';
-            books.push_back(book);
+            storeBook(book);
+
+            ByteWriter record;
+            writeStringData(record, book.getId());
+            writeStringData(record, book.getTitle());
+            writeStringData(record, book.getAuthor());
+            writeStringData(record, book.getGenre());
+            writeData(record, book.getYear());
+            writeData(record, book.getQuantity());
+            writeData(record, book.getIsAvailable());
+            uint64_t logged = logOperation(LOG_APPEND_BOOK, record, false);
+            lock.unlock();
+            waitLogged(logged);
         }
         
         // Add a reader to the library
         void appendReader(const Reader &reader)
         {
+            ExclusiveLock lock(catalogMutex);
             cout << "Appending reader: " << reader.getName() << '\n';
-            readers.push_back(reader);
+            storeReader(reader);
+
+            ByteWriter record;
+            writeStringData(record, reader.getId());
+            writeStringData(record, reader.getName());
+            writeData(record, static_cast<uint32_t>(reader.getBorrowedBooks().size()));
+            for(uint32_t bookHandle : reader.getBorrowedBooks())
+            {
+                writeStringData(record, bookIds.name(bookHandle));
+            }
+            uint64_t logged = logOperation(LOG_APPEND_READER, record, false);
+            lock.unlock();
+            waitLogged(logged);
         }
 
         // Edit book title
         bool editBookTitle(const string &bookID, string &newTitle)
         {
-            Book* book = findBook(bookID);
+            ExclusiveLock lock(catalogMutex);
+            uint32_t handle = findBookHandle(bookID);
 
-            if(book)
+            if(handle != IdDictionary::NO_HANDLE)
             {
-                book->setTitle(newTitle);
+                changeBookTitle(handle, loadedRowOf(handle), newTitle);
+
+                ByteWriter record;
+                writeStringData(record, bookID);
+                writeStringData(record, newTitle);
+                uint64_t logged = logOperation(LOG_EDIT_TITLE, record, false);
+                lock.unlock();
+                waitLogged(logged);
                 return true;
             }  
             return false;
@@ -143,11 +1854,19 @@ class Library
         // Edit book author
         bool editBookAuthor(const string &bookID, string &newAuthor)
         {
-            Book* book = findBook(bookID);
+            ExclusiveLock lock(catalogMutex);
+            uint32_t handle = findBookHandle(bookID);
 
-            if(book)
+            if(handle != IdDictionary::NO_HANDLE)
             {
-                book->setAuthor(newAuthor);
+                changeBookAuthor(handle, loadedRowOf(handle), newAuthor);
+
+                ByteWriter record;
+                writeStringData(record, bookID);
+                writeStringData(record, newAuthor);
+                uint64_t logged = logOperation(LOG_EDIT_AUTHOR, record, false);
+                lock.unlock();
+                waitLogged(logged);
                 return true;
             }
             return false;
@@ -156,11 +1875,19 @@ class Library
         // Edit book genre
         bool editBookGenre(const string &bookID, string &newGenre)
         {
-            Book* book = findBook(bookID);
+            ExclusiveLock lock(catalogMutex);
+            uint32_t handle = findBookHandle(bookID);
 
-            if(book)
+            if(handle != IdDictionary::NO_HANDLE)
             {
-                book->setGenre(newGenre);
+                changeBookGenre(handle, loadedRowOf(handle), newGenre);
+
+                ByteWriter record;
+                writeStringData(record, bookID);
+                writeStringData(record, newGenre);
+                uint64_t logged = logOperation(LOG_EDIT_GENRE, record, false);
+                lock.unlock();
+                waitLogged(logged);
                 return true;
             }
             return false;
@@ -169,11 +1896,19 @@ class Library
         // Edit book year
         bool editBookYear(const string &bookID, int &newYear)
         {
-            Book* book = findBook(bookID);
+            ExclusiveLock lock(catalogMutex);
+            uint32_t handle = findBookHandle(bookID);
 
-            if(book)
+            if(handle != IdDictionary::NO_HANDLE)
             {
-                book->setYear(newYear);
+                changeBookYear(handle, loadedRowOf(handle), newYear);
+
+                ByteWriter record;
+                writeStringData(record, bookID);
+                writeData(record, newYear);
+                uint64_t logged = logOperation(LOG_EDIT_YEAR, record, false);
+                lock.unlock();
+                waitLogged(logged);
                 return true;
             }
             return false;
@@ -182,22 +1917,32 @@ class Library
         // Edit book details
         bool editBookDetail(const string &bookID, const string &newTitle, const string &newAuthor, const string &newGenre, const int &newYear, const int &newQuantity)
         {
-            Book *book = findBook(bookID);
+            ExclusiveLock lock(catalogMutex);
+            uint32_t handle = findBookHandle(bookID);
 
-            if(book)
+            if(handle != IdDictionary::NO_HANDLE)
             {
-                book->setTitle(newTitle);
-                book->setAuthor(newAuthor);
-                book->setGenre(newGenre);
-                book->setYear(newYear);
-                book->setQuantity(newQuantity);
-
-                if (newQuantity > 0)
-                {
-                    bool available = true;
-                    book->setIsAvailable(available);
-                }
-
+                size_t row = loadedRowOf(handle);
+                unindexBook(row);
+                books.setTitle(row, newTitle);
+                books.setAuthor(row, newAuthor);
+                books.setGenre(row, newGenre);
+                books.setYear(row, newYear);
+                books.setQuantity(row, newQuantity);
+                indexBook(row);
+                bookSegments.touch(handle);
+
+
+                ByteWriter record;
+                writeStringData(record, bookID);
+                writeStringData(record, newTitle);
+                writeStringData(record, newAuthor);
+                writeStringData(record, newGenre);
+                writeData(record, newYear);
+                writeData(record, newQuantity);
+                uint64_t logged = logOperation(LOG_EDIT_DETAIL, record, false);
+                lock.unlock();
+                waitLogged(logged);
                 return true;
             }
             return false;
@@ -206,18 +1951,22 @@ class Library
         // Display book details
         void displayBookDetail(const string &bookID)
         {
-            Book *book = findBook(bookID);
+            UpgradableLock lock(catalogMutex);
+            lock.upgradeIf(needsDecoding(bookID));
+            size_t row = findBookRow(bookID);
+            std::shared_lock<std::shared_timed_mutex> bookLock(bookLocks.of(bookIds.find(bookID)));
 
-            if(book)
+            if(row != BookStore::NO_ROW)
             {
+                BookRef book(&books, row);
                 cout << "=== CURRENT BOOK STATUS ===\n";
-                cout << "Book ID: " << book->getId() << '\n';
-                cout << "Title: " << book->getTitle() << '\n';
-                cout << "Author: " << book->getAuthor() << '\n';
-                cout <<"Genre: " << book->getGenre() << '\n';
-                cout << "Year: " << book->getYear() << '\n';
-                cout << "Quantity: " << book->getQuantity() << '\n';
-                cout << "Available: " << (book->getIsAvailable() ? "Yes" : "No") << '\n';
+                cout << "Book ID: " << book.getId() << '\n';
+                cout << "Title: " << book.getTitle() << '\n';
+                cout << "Author: " << book.getAuthor() << '\n';
+                cout <<"Genre: " << book.getGenre() << '\n';
+                cout << "Year: " << book.getYear() << '\n';
+                cout << "Quantity: " << book.getQuantity() << '\n';
+                cout << "Available: " << (book.getIsAvailable() ? "Yes" : "No") << '\n';
                 cout << "---------------------------\n";
             } 
             else 
@@ -229,95 +1978,402 @@ class Library
         // Edit reader name
         bool editReaderName(const string &readerID, string &newName)
         {
-            Reader *reader = findReader(readerID);
+            ExclusiveLock lock(catalogMutex);
+            uint32_t handle = findReaderHandle(readerID);
 
-            if(reader)
+            if(handle != IdDictionary::NO_HANDLE)
             {
-                reader->setName(newName);
+                readers[readerPositions[handle]].setName(newName);
+                readerSegments.touch(handle);
+
+                ByteWriter record;
+                writeStringData(record, readerID);
+                writeStringData(record, newName);
+                uint64_t logged = logOperation(LOG_EDIT_READER_NAME, record, false);
+                lock.unlock();
+                waitLogged(logged);
                 return true;
             }
             return false;
         }
 
-        // Borrow a book
+        // Borrow a book. Borrows and returns of different books by different readers run in parallel.
         bool borrowBook(const string &bookID, const string &readerID)
         {
-            Reader* reader = findReader(readerID);
-            Book* book = findBook(bookID);
-
-            if(!reader)
+            uint64_t logged;
+            if(!borrowLocked(bookID, readerID, logged))
             {
-                cout << "Error: Reader ID not found.\n";
                 return false;
             }
+            waitLogged(logged);
+            return true;
+        }
 
-            if(!book)
+        // Return a book
+        bool returnBook(const string &bookID, const string &readerID)
+        {
+            uint64_t logged;
+            if(!returnLocked(bookID, readerID, logged))
             {
-                cout << "Error: Book ID not found.\n";
                 return false;
             }
+            waitLogged(logged);
+            return true;
+        }
+
+        // Apply a list of borrows, returns and book edits in order, under one lock and with one journal sync,
+        // and report a status for each instead of printing errors. BATCH_ALL_OR_NOTHING applies all of them or,
+        // at the first failure, undoes those already applied and leaves the library as it was; BATCH_EACH applies
+        // every operation that can be applied. Returns true if every operation was applied.
+        bool applyBatch(const std::vector<BatchOperation> &operations, BatchMode mode, BatchReport &report)
+        {
+            uint64_t logged;
+            bool applied = applyBatch(operations, mode, report, logged);
+
+            waitLogged(logged);
+            return applied;
+        }
 
-            if(!book->getIsAvailable())
+        // applyBatch without waiting for its journal record to reach the disk; the caller waits with waitDurable,
+        // so batches from several callers can share one sync
+        bool applyBatch(const std::vector<BatchOperation> &operations, BatchMode mode, BatchReport &report, uint64_t &logged)
+        {
+            logged = 0;
+            report.results.assign(operations.size(), BATCH_NOT_APPLIED);
+            report.applied = 0;
+            report.failed = 0;
+
+            ExclusiveLock lock(catalogMutex);
+            std::vector<BatchOperation> undo;
+            std::vector<ByteWriter> parts;
+            ByteWriter record;
+            BatchOperation inverse = BatchOperation::borrow(string(), string());
+            size_t i = 0;
+
+            for(; i < operations.size(); ++i)
             {
-                cout << "Error: Book is not available for borrowing.\n";
+                BatchStatus status = applyBatchOperation(operations[i], inverse);
+
+                report.results[i] = status;
+                if(status != BATCH_OK)
+                {
+                    ++report.failed;
+                    if(mode == BATCH_ALL_OR_NOTHING)
+                    {
+                        break;
+                    }
+                    continue;
+                }
+
+                ++report.applied;
+                if(record.size() >= JOURNAL_PART_SIZE)
+                {
+                    parts.push_back(std::move(record));
+                    record = ByteWriter();
+                }
+                writeBatchOperation(record, operations[i]);
+                if(mode == BATCH_ALL_OR_NOTHING)
+                {
+                    undo.push_back(inverse);
+                }
+            }
+
+            if(i < operations.size())
+            {
+                // Undo in reverse order; each inverse applies, as it undoes the step just before it
+                for(size_t done = undo.size(); done-- > 0; )
+                {
+                    applyBatchOperation(undo[done], inverse);
+                    report.results[done] = BATCH_NOT_APPLIED;
+                }
+                report.applied = 0;
                 return false;
             }
 
-            
-            book->setQuantity(book->getQuantity() - 1);
+            // The leading parts are only replayed together with the final record, so a crash between them applies none
+            for(const auto &part : parts)
+            {
+                logOperation(LOG_BATCH_PART, part, false);
+            }
+            if(record.size() > 0)
+            {
+                logged = logOperation(LOG_BATCH, record, false);
+            }
+            return report.failed == 0;
+        }
+
+        // Wait until the changes of an applyBatch that did not wait are on disk
+        void waitDurable(uint64_t logged)
+        {
+            waitLogged(logged);
+        }
+
+        private:
+        // Borrow a book under the locks, leaving the journal record to be waited for
+        bool borrowLocked(const string &bookID, const string &readerID, uint64_t &logged)
+        {
+            UpgradableLock lock(catalogMutex);
+            lock.upgradeIf(needsDecoding(bookID));
+            uint32_t readerHandle = findReaderHandle(readerID);
+            uint32_t bookHandle = findBookHandle(bookID);
+
+            if(readerHandle == IdDictionary::NO_HANDLE)
+            {
+                cout << "Error: Reader ID not found.\n";
+                return false;
+            }
 
-            if(book->getQuantity() == 0)
+            if(bookHandle == IdDictionary::NO_HANDLE)
             {
-                bool available = false;
-                book->setIsAvailable(available);
+                cout << "Error: Book ID not found.\n";
+                return false;
             }
 
-            reader->appendBorrowedBook(bookID);
+            // The copy is taken without a lock; the stripes only guard the loan records
+            size_t row = loadedRowOf(bookHandle);
+            if(!books.takeCopy(row))
+            {
+                cout << "Error: Book is not available for borrowing.\n";
+                return false;
+            }
 
+            std::unique_lock<std::shared_timed_mutex> bookLock(bookLocks.of(bookHandle));
+            std::unique_lock<std::shared_timed_mutex> readerLock(readerLocks.of(readerHandle));
+            Reader *reader = &readers[readerPositions[readerHandle]];
+            reader->appendBorrowedBook(bookHandle);
+            addBorrower(bookHandle, readerHandle);
+            touchCirculation(bookHandle, readerHandle);
+
+            ByteWriter record;
+            writeStringData(record, bookID);
+            writeStringData(record, readerID);
+            logged = logOperation(LOG_BORROW, record, false);
             return true;
         }
 
-        // Return a book
-        bool returnBook(const string &bookID, const string &readerID)
+        // Return a book under the locks, leaving the journal record to be waited for
+        bool returnLocked(const string &bookID, const string &readerID, uint64_t &logged)
         {
-            Reader* reader = findReader(readerID);
-            Book* book = findBook(bookID);
+            UpgradableLock lock(catalogMutex);
+            lock.upgradeIf(needsDecoding(bookID));
+            uint32_t readerHandle = findReaderHandle(readerID);
+            uint32_t bookHandle = findBookHandle(bookID);
 
-            if(!reader)
+            if(readerHandle == IdDictionary::NO_HANDLE)
             {
                 cout << "Error: Reader ID not found.\n";
                 return false;
             }
 
-            if(!book)
+            if(bookHandle == IdDictionary::NO_HANDLE)
             {
                 cout << "Error: Book ID not found.\n";
                 return false;
             }
 
-            if(!reader->hasBorrowedBook(bookID))
+            std::unique_lock<std::shared_timed_mutex> bookLock(bookLocks.of(bookHandle));
+            std::unique_lock<std::shared_timed_mutex> readerLock(readerLocks.of(readerHandle));
+            Reader *reader = &readers[readerPositions[readerHandle]];
+            size_t row = loadedRowOf(bookHandle);
+
+            if(!hasBorrower(bookHandle, readerHandle))
             {
                 cout << "Error: Book ID not found in reader's borrowed books.\n";
                 return false;
             }
 
-            book->setQuantity(book->getQuantity() + 1);
+            books.returnCopy(row);
+            reader->deleteBorrowedBooks(bookHandle);
+            removeBorrower(bookHandle, readerHandle);
+            touchCirculation(bookHandle, readerHandle);
+
+            ByteWriter record;
+            writeStringData(record, bookID);
+            writeStringData(record, readerID);
+            logged = logOperation(LOG_RETURN, record, false);
+            return true;
+        }
+
+        // Change one field of a loaded book, keeping the indexes up to date
+        void changeBookTitle(uint32_t handle, size_t row, const string &title)
+        {
+            removeFromIndex(titleIndex, books.getTitle(row), handle);
+            books.setTitle(row, title);
+            addToIndex(titleIndex, title, handle);
+            textIndex.add(handle, books.getTitle(row), books.getAuthor(row));
+            bookSegments.touch(handle);
+        }
+
+        void changeBookAuthor(uint32_t handle, size_t row, const string &author)
+        {
+            removeFromIndex(authorIndex, books.getAuthor(row), handle);
+            books.setAuthor(row, author);
+            addToIndex(authorIndex, author, handle);
+            textIndex.add(handle, books.getTitle(row), books.getAuthor(row));
+            bookSegments.touch(handle);
+        }
+
+        void changeBookGenre(uint32_t handle, size_t row, const string &genre)
+        {
+            removeFromIndex(genreIndex, books.getGenre(row), handle);
+            books.setGenre(row, genre);
+            addToIndex(genreIndex, genre, handle);
+            bookSegments.touch(handle);
+        }
+
+        void changeBookYear(uint32_t handle, size_t row, int year)
+        {
+            yearIndex.erase(books.getYear(row), handle);
+            books.setYear(row, year);
+            yearIndex.insert(year, handle);
+            bookSegments.touch(handle);
+        }
 
-            if(book->getQuantity() > 0)
+        // Apply one operation of a batch, with the exclusive catalog lock held and without printing anything.
+        // On success, inverse is set to the operation that undoes it.
+        BatchStatus applyBatchOperation(const BatchOperation &operation, BatchOperation &inverse)
+        {
+            uint32_t bookHandle = findBookHandle(operation.getBookId());
+            if(bookHandle == IdDictionary::NO_HANDLE)
             {
-                bool available = true;
-                book->setIsAvailable(available);
+                return BATCH_NO_SUCH_BOOK;
             }
+            size_t row = loadedRowOf(bookHandle);
 
-            reader->deleteBorrowedBooks(bookID);
-            
+            switch(operation.getKind())
+            {
+                case BatchOperation::BORROW:
+                case BatchOperation::RETURN:
+                {
+                    uint32_t readerHandle = findReaderHandle(operation.getReaderId());
+                    if(readerHandle == IdDictionary::NO_HANDLE)
+                    {
+                        return BATCH_NO_SUCH_READER;
+                    }
+
+                    Reader &reader = readers[readerPositions[readerHandle]];
+                    if(operation.getKind() == BatchOperation::BORROW)
+                    {
+                        if(!books.takeCopy(row))
+                        {
+                            return BATCH_NOT_AVAILABLE;
+                        }
+                        reader.appendBorrowedBook(bookHandle);
+                        addBorrower(bookHandle, readerHandle);
+                        inverse = BatchOperation::giveBack(operation.getBookId(), operation.getReaderId());
+                    }
+                    else
+                    {
+                        if(!hasBorrower(bookHandle, readerHandle))
+                        {
+                            return BATCH_NOT_BORROWED;
+                        }
+                        books.returnCopy(row);
+                        reader.deleteBorrowedBooks(bookHandle);
+                        removeBorrower(bookHandle, readerHandle);
+                        inverse = BatchOperation::borrow(operation.getBookId(), operation.getReaderId());
+                    }
+                    bookSegments.touch(bookHandle);
+                    readerSegments.touch(readerHandle);
+                    return BATCH_OK;
+                }
+                case BatchOperation::EDIT_TITLE:
+                    inverse = BatchOperation::edit(BatchOperation::EDIT_TITLE, operation.getBookId(), books.getTitle(row).str());
+                    changeBookTitle(bookHandle, row, operation.getText());
+                    return BATCH_OK;
+                case BatchOperation::EDIT_AUTHOR:
+                    inverse = BatchOperation::edit(BatchOperation::EDIT_AUTHOR, operation.getBookId(), books.getAuthor(row).str());
+                    changeBookAuthor(bookHandle, row, operation.getText());
+                    return BATCH_OK;
+                case BatchOperation::EDIT_GENRE:
+                    inverse = BatchOperation::edit(BatchOperation::EDIT_GENRE, operation.getBookId(), books.getGenre(row));
+                    changeBookGenre(bookHandle, row, operation.getText());
+                    return BATCH_OK;
+                case BatchOperation::EDIT_YEAR:
+                    if(operation.getNumber() < 0)
+                    {
+                        return BATCH_INVALID_VALUE;
+                    }
+                    inverse = BatchOperation::edit(BatchOperation::EDIT_YEAR, operation.getBookId(), books.getYear(row));
+                    changeBookYear(bookHandle, row, operation.getNumber());
+                    return BATCH_OK;
+                case BatchOperation::EDIT_QUANTITY:
+                    if(operation.getNumber() < 0)
+                    {
+                        return BATCH_INVALID_VALUE;
+                    }
+                    inverse = BatchOperation::edit(BatchOperation::EDIT_QUANTITY, operation.getBookId(), books.getQuantity(row));
+                    books.setQuantity(row, operation.getNumber());
+                    bookSegments.touch(bookHandle);
+                    return BATCH_OK;
+            }
+            return BATCH_INVALID_VALUE;
+        }
+
+        // Append an operation to a LOG_BATCH record
+        void writeBatchOperation(ByteWriter &record, const BatchOperation &operation)
+        {
+            writeData(record, static_cast<uint8_t>(operation.getKind()));
+            writeStringData(record, operation.getBookId());
+            writeStringData(record, operation.getReaderId());
+            writeStringData(record, operation.getText());
+            writeData(record, operation.getNumber());
+        }
+
+        // Read the operations of a LOG_BATCH or LOG_BATCH_PART record, appending them; false if it is damaged
+        bool readBatchOperations(ByteReader &record, std::vector<BatchOperation> &operations)
+        {
+            string bookID, readerID, text;
+            uint8_t kind;
+            int number;
+
+            while(record.remaining() > 0)
+            {
+                if(!readData(record, kind) || kind > BatchOperation::EDIT_QUANTITY || !readStringData(record, bookID) ||
+                   !readStringData(record, readerID) || !readStringData(record, text) || !readData(record, number))
+                {
+                    return false;
+                }
+
+                BatchOperation::Kind operation = static_cast<BatchOperation::Kind>(kind);
+                if(operation == BatchOperation::BORROW)
+                {
+                    operations.push_back(BatchOperation::borrow(bookID, readerID));
+                }
+                else if(operation == BatchOperation::RETURN)
+                {
+                    operations.push_back(BatchOperation::giveBack(bookID, readerID));
+                }
+                else if(operation == BatchOperation::EDIT_YEAR || operation == BatchOperation::EDIT_QUANTITY)
+                {
+                    operations.push_back(BatchOperation::edit(operation, bookID, number));
+                }
+                else
+                {
+                    operations.push_back(BatchOperation::edit(operation, bookID, text));
+                }
+            }
             return true;
         }
 
+        // Mark the segments of a book and a reader changed by circulation, which holds only the shared catalog lock
+        void touchCirculation(uint32_t bookHandle, uint32_t readerHandle)
+        {
+            std::lock_guard<std::mutex> lock(touchMutex);
+            bookSegments.touch(bookHandle);
+            readerSegments.touch(readerHandle);
+        }
+
+        public:
+
         // Display borrowed books
         void displayBorrowedBooks(const string &readerID)
         {
+            UpgradableLock lock(catalogMutex);
+            lock.upgradeIf(needsDecodingAny());
+            AllStripesShared bookLock(bookLocks);
             Reader *reader = findReader(readerID);
+            std::shared_lock<std::shared_timed_mutex> readerLock(readerLocks.of(readerIds.find(readerID)));
 
             if(!reader)
             {
@@ -332,23 +2388,28 @@ class Library
             }
             
             cout << "Borrowed books for reader " << reader->getName() << ":\n";
-            for(const auto &bookID: reader->getBorrowedBooks())
+            for(uint32_t bookHandle : reader->getBorrowedBooks())
             {
-                Book *book = findBook(bookID);
-
-                if(book)
+                size_t row = loadedRowOf(bookHandle);
+                if(row != BookStore::NO_ROW)
                 {
-                    cout << "Book ID: " << book->getId() << '\n';
-                    cout << "Title: " << book->getTitle() << '\n';
-                    cout << "Author: " << book->getAuthor() << '\n';
+                    BookRef book(&books, row);
+                    cout << "Book ID: " << book.getId() << '\n';
+                    cout << "Title: " << book.getTitle() << '\n';
+                    cout << "Author: " << book.getAuthor() << '\n';
                     cout << "--------------------------\n";
                 }
             }
         }
 
         // Display all books in the library
-        void displayBooks() const
+        void displayBooks()
         {
+            UpgradableLock lock(catalogMutex);
+            lock.upgradeIf(needsDecodingAny());
+            AllStripesShared bookLock(bookLocks);
+            loadAllBooks();
+
             if(!books.empty())
             {
                 int maxIdWidth = 7;
@@ -359,13 +2420,10 @@ class Library
                 int maxQuantityWidth = 8;
                 int maxAvailableWidth = 9;
 
-                for(const auto &book: books)
-                {
-                    maxIdWidth = (std::max)(maxIdWidth, static_cast<int>(book.getId().length()));
-                    maxTitleWidth = (std::max)(maxTitleWidth, static_cast<int>(book.getTitle().length()));
-                    maxAuthorWidth = (std::max)(maxAuthorWidth, static_cast<int>(book.getAuthor().length()));
-                    maxGenreWidth = (std::max)(maxGenreWidth, static_cast<int>(book.getGenre().length()));
-                }
+                maxIdWidth = (std::max)(maxIdWidth, static_cast<int>(books.maxIdLength()));
+                maxTitleWidth = (std::max)(maxTitleWidth, static_cast<int>(books.maxTitleLength()));
+                maxAuthorWidth = (std::max)(maxAuthorWidth, static_cast<int>(books.maxAuthorLength()));
+                maxGenreWidth = (std::max)(maxGenreWidth, static_cast<int>(books.maxGenreLength()));
 
                 cout << std::string(maxIdWidth + maxTitleWidth + maxAuthorWidth + maxGenreWidth + maxYearWidth + maxQuantityWidth + maxAvailableWidth + 22, '=') << '\n';
                 cout << "| " << std::setw(maxIdWidth) << "Book ID" << " | "
@@ -377,8 +2435,9 @@ class Library
                      << std::setw(maxAvailableWidth) << "Available" << " |\n";
                 cout << std::string(maxIdWidth + maxTitleWidth + maxAuthorWidth + maxGenreWidth + maxYearWidth + maxQuantityWidth + maxAvailableWidth + 22, '=') << '\n';
 
-                for(const auto &book: books)
+                for(size_t row = 0; row < books.size(); ++row)
                 {
+                    BookRef book(&books, row);
                     cout << "| " << std::setw(maxIdWidth) << book.getId() << " | "
                          << std::setw(maxTitleWidth) << book.getTitle() << " | "
                          << std::setw(maxAuthorWidth) << book.getAuthor() << " | "
@@ -388,6 +2447,8 @@ class Library
                          << std::setw(maxAvailableWidth) << (book.getIsAvailable() ? "Yes" : "No") << " |\n";
                 }
                 cout << std::string(maxIdWidth + maxTitleWidth + maxAuthorWidth + maxGenreWidth + maxYearWidth + maxQuantityWidth + maxAvailableWidth + 22, '=') << '\n';
+                cout << books.size() << " titles, " << books.totalQuantity() << " copies on the shelf, "
+                     << books.countAvailable() << " titles available\n";
             }
             else
             {
@@ -398,6 +2459,8 @@ class Library
         // Display all readers in the library
         void displayReaders() const
         {
+            SharedLock lock(catalogMutex);
+            AllStripesShared readerLock(readerLocks);
             if(!readers.empty())
             {
                 int maxIdWidth = 9;
@@ -433,137 +2496,332 @@ class Library
         // Check if the book is borrowed by any reader
         bool isBorrowedBook(const string &bookID)
         {
-            for (auto &reader : readers)
+            SharedLock lock(catalogMutex);
+            uint32_t bookHandle = bookIds.find(bookID);
+            std::shared_lock<std::shared_timed_mutex> bookLock(bookLocks.of(bookHandle));
+
+            return bookHandle != IdDictionary::NO_HANDLE && !borrowers[bookHandle].empty();
+        }
+
+        // Check if the book is borrowed by a reader
+        bool isBorrowedBook(const string &bookID, const string &readerID)
+        {
+            SharedLock lock(catalogMutex);
+            uint32_t bookHandle = bookIds.find(bookID);
+            uint32_t readerHandle = readerIds.find(readerID);
+            std::shared_lock<std::shared_timed_mutex> bookLock(bookLocks.of(bookHandle));
+
+            if(bookHandle == IdDictionary::NO_HANDLE || readerHandle == IdDictionary::NO_HANDLE)
+            {
+                return false;
+            }
+            return hasBorrower(bookHandle, readerHandle);
+        }
+
+        // Get the IDs of all readers currently holding a book
+        std::vector<string> getBookBorrowers(const string &bookID)
+        {
+            std::vector<string> readerList;
+            SharedLock lock(catalogMutex);
+            uint32_t bookHandle = bookIds.find(bookID);
+            std::shared_lock<std::shared_timed_mutex> bookLock(bookLocks.of(bookHandle));
+
+            if(bookHandle != IdDictionary::NO_HANDLE)
             {
-                if (reader.hasBorrowedBook(bookID))
+                readerList.reserve(borrowers[bookHandle].size());
+                for(const auto &borrower : borrowers[bookHandle])
                 {
-                    return true;
+                    readerList.push_back(readerIds.name(borrower.first));
+                }
+            }
+            return readerList;
+        }
+
+        // Get total number of books borrowed by a reader
+        int getReaderBorrowedBook(const string &readerID)
+        {
+            SharedLock lock(catalogMutex);
+            Reader *reader = findReader(readerID);
+            std::shared_lock<std::shared_timed_mutex> readerLock(readerLocks.of(readerIds.find(readerID)));
+
+            if(reader)
+            {
+                return reader->getBorrowedBooks().size();
+            }
+                return 0;
+        }
+
+        // Delete a book from the library (books still on loan are kept)
+        bool deleteBook(const string &bookID)
+        {
+            ExclusiveLock lock(catalogMutex);
+            uint32_t handle = findBookHandle(bookID);
+
+            if(handle != IdDictionary::NO_HANDLE && borrowers[handle].empty())
+            {
+                size_t row = loadedRowOf(handle);
+                unindexBook(row);
+                books.erase(row);
+                bookSegments.remove(handle);
+
+                ByteWriter record;
+                writeStringData(record, bookID);
+                uint64_t logged = logOperation(LOG_DELETE_BOOK, record, false);
+                lock.unlock();
+                waitLogged(logged);
+                return true;
+            }
+            return false;
+        }
+
+        private:
+        // Take a reader out of the reader list, dropping its loans; returnCopies also puts the copies back on the shelf
+        void removeReader(uint32_t handle, bool returnCopies)
+        {
+            size_t position = readerPositions[handle];
+
+            for (uint32_t bookHandle : readers[position].getBorrowedBooks())
+            {
+                removeBorrower(bookHandle, handle);
+
+                size_t row = returnCopies ? loadedRowOf(bookHandle) : BookStore::NO_ROW;
+                if (row != BookStore::NO_ROW)
+                {
+                    books.returnCopy(row);
+                    bookSegments.touch(bookHandle);
                 }
             }
+            readerSegments.remove(handle);
+
+            // Move the last reader into the freed position
+            readerPositions[readerHandles.back()] = position;
+            readerPositions[handle] = NO_POSITION;
+            readers[position] = std::move(readers.back());
+            readers.pop_back();
+            readerHandles[position] = readerHandles.back();
+            readerHandles.pop_back();
+        }
+
+        public:
+        // Delete a reader from the library
+        bool deleteReader(const string &readerID)
+        {
+            ExclusiveLock lock(catalogMutex);
+            uint32_t handle = findReaderHandle(readerID);
+
+            if(handle != IdDictionary::NO_HANDLE)
+            {
+                removeReader(handle, true);
+
+                ByteWriter record;
+                writeStringData(record, readerID);
+                uint64_t logged = logOperation(LOG_DELETE_READER, record, false);
+                lock.unlock();
+                waitLogged(logged);
+                return true;
+            }
             return false;
         }
 
-        // Check if the book is borrowed by a reader
-        bool isBorrowedBook(const string &bookID, const string &readerID)
+        // Find books by title
+        std::vector<Book> findBookByTitle(const string &findTitle)
+        {
+            UpgradableLock lock(catalogMutex);
+            lock.upgradeIf(needsDecodingAny());
+            loadAllBooks();
+            return lookupIndex(titleIndex, findTitle);
+        }
+
+        // Find books by genre
+        std::vector<Book> findBookByGenre(const string &findGenre)
+        {
+            UpgradableLock lock(catalogMutex);
+            lock.upgradeIf(needsDecodingAny());
+            loadAllBooks();
+            return lookupIndex(genreIndex, findGenre);
+        }
+
+        // Find books by keywords in their title or author, best matches first
+        std::vector<Book> searchBooks(const string &query, size_t limit = 50)
+        {
+            UpgradableLock lock(catalogMutex);
+            lock.upgradeIf(needsDecodingAny());
+            loadAllBooks();
+            return resolveBooks(textIndex.search(query, limit));
+        }
+
+        // Find books published between two years (inclusive), oldest first
+        std::vector<Book> findBookByYear(int fromYear, int toYear)
         {
-            Reader *reader = findReader(readerID);
+            UpgradableLock lock(catalogMutex);
+            lock.upgradeIf(needsDecodingAny());
+            loadAllBooks();
+            return resolveBooks(yearIndex.range(fromYear, toYear));
+        }
 
-            if(!reader)
-            {
-                return false;
-            }
+        // Count books published between two years (inclusive)
+        size_t countBookByYear(int fromYear, int toYear)
+        {
+            UpgradableLock lock(catalogMutex);
+            lock.upgradeIf(needsDecodingAny());
+            loadAllBooks();
+            return yearIndex.count(fromYear, toYear);
+        }
 
-            if(reader->hasBorrowedBook(bookID))
-            {
-                return true;
-            }
-            return false;
+        // Find the most recently published books, newest first
+        std::vector<Book> findNewestBooks(size_t count)
+        {
+            UpgradableLock lock(catalogMutex);
+            lock.upgradeIf(needsDecodingAny());
+            loadAllBooks();
+            return resolveBooks(yearIndex.top(count));
         }
 
-        // Get total number of books borrowed by a reader
-        int getReaderBorrowedBook(const string &readerID)
+        // Find books matching a compound query, in catalog order
+        std::vector<Book> findBooks(const BookQuery &query)
         {
-            Reader *reader = findReader(readerID);
+            std::vector<Book> foundBooks;
+            UpgradableLock lock(catalogMutex);
+            lock.upgradeIf(needsDecodingAny());
+            AllStripesShared bookLock(bookLocks);
 
-            if(reader)
+            loadAllBooks();
+            forEachMatch(query, [this, &foundBooks](size_t row)
             {
-                return reader->getBorrowedBooks().size();
-            }
-                return 0;
+                foundBooks.push_back(books.get(row));
+            });
+            return foundBooks;
         }
 
-        // Delete a book from the library
-        bool deleteBook(const string &bookID)
+        // Count books matching a compound query without collecting them
+        size_t countBooks(const BookQuery &query)
         {
-            auto it = std::find_if(books.begin(), books.end(), [&bookID](Book &book)
+            UpgradableLock lock(catalogMutex);
+            lock.upgradeIf(needsDecodingAny());
+            AllStripesShared bookLock(bookLocks);
+            loadAllBooks();
+
+            // A single indexed field is answered by the index size alone
+            switch(query.getKind())
             {
-                return book.getId() == bookID;
-            });
+                case BookQuery::TITLE:
+                case BookQuery::AUTHOR:
+                case BookQuery::GENRE:
+                case BookQuery::YEAR_RANGE:
+                    return estimate(query);
+                default:
+                    break;
+            }
 
-            if(it != books.end())
+            size_t count = 0;
+
+            if(shouldScan(query))
             {
-                books.erase(it);
-                return true;
+                std::vector<uint8_t> mask(books.size(), 1);
+                filterRows(query, mask);
+                for(uint8_t selected : mask)
+                {
+                    count += selected;
+                }
+                return count;
             }
-            return false;
-        }
 
-        // Delete a reader from the library
-        bool deleteReader(const string &readerID)
-        {
-            auto it = std::find_if(readers.begin(), readers.end(), [&readerID](Reader &reader)
+            visitCandidates(query, [this, &query, &count](size_t position)
             {
-                return reader.getId() == readerID;
+                if(query.matches(BookRef(&books, position)))
+                {
+                    ++count;
+                }
             });
+            return count;
+        }
+
+        // After a lazy load, drop the decoded records of the least recently used book segments that are unchanged
+        // since loading, until at most keepSegments segments are decoded. They are decoded again on next use.
+        void evictColdBooks(size_t keepSegments)
+        {
+            ExclusiveLock lock(catalogMutex);
+            std::vector<uint32_t> candidates;
+            size_t decoded = 0;
 
-            if(it != readers.end())
+            for(uint32_t segment = 0; segment < lazySegments.size(); ++segment)
             {
-                // Return all borrowed books
-                for (const auto &bookID : it->getBorrowedBooks())
+                if(segmentDecoded[segment])
                 {
-                    Book* book = findBook(bookID);
-                    if (book)
+                    ++decoded;
+                    if(segmentPristine[segment] && !bookSegments.dirtyFlags()[segment])
                     {
-                        book->setQuantity(book->getQuantity() + 1);
-                        if (book->getQuantity() > 0)
-                        {
-                            bool available = true;
-                            book->setIsAvailable(available);
-                        }
+                        candidates.push_back(segment);
                     }
                 }
+            }
+            std::sort(candidates.begin(), candidates.end(), [this](uint32_t a, uint32_t b)
+            {
+                return segmentLastUse[a].load() < segmentLastUse[b].load();
+            });
 
-                readers.erase(it);
-                return true;
+            for(uint32_t segment : candidates)
+            {
+                if(decoded <= keepSegments)
+                {
+                    break;
+                }
+                for(uint32_t handle : bookSegments.membersOf(segment))
+                {
+                    size_t row = books.rowOf(handle);
+                    unindexBook(row);
+                    books.blank(row);
+                }
+                segmentDecoded[segment] = 0;
+                --decoded;
             }
-            return false;
         }
 
-        // Find books by title
-        std::vector<Book*> findBookByTitle(const string &findTitle)
+        // Find books by ID
+        std::vector<Book> findBookByID(const string &findBookID)
         {
-            std::vector<Book*> foundBooks;
+            std::vector<Book> foundBooks;
+            UpgradableLock lock(catalogMutex);
+            lock.upgradeIf(needsDecoding(findBookID));
+            size_t row = findBookRow(findBookID);
 
-            for(auto &book: books)
+            if(row != BookStore::NO_ROW)
             {
-                if(book.getTitle() == findTitle)
-                {
-                    foundBooks.push_back(&book);
-                }
+                foundBooks.push_back(books.get(row));
             }
             return foundBooks;
         }
 
-        // Find books by genre
-        std::vector<Book*> findBookByGenre(const string &findGenre)
+        // Page through the books in catalog order
+        std::vector<Book> listBooks(size_t offset, size_t limit)
         {
-            std::vector<Book*> foundBooks;
+            std::vector<Book> foundBooks;
+            UpgradableLock lock(catalogMutex);
+            lock.upgradeIf(needsDecodingAny());
+            loadAllBooks();
 
-            for(auto &book: books)
+            for(size_t row = offset; row < books.size() && foundBooks.size() < limit; ++row)
             {
-                if(book.getGenre() == findGenre)
-                {
-                    foundBooks.push_back(&book);
-                }
+                foundBooks.push_back(books.get(row));
             }
             return foundBooks;
         }
 
-        // Find books by ID
-        std::vector<Book*> findBookByID(const string &findBookID)
+        // Page through the IDs of the readers
+        std::vector<string> listReaderIds(size_t offset, size_t limit) const
         {
-            std::vector<Book*> foundBooks;
-            Book* book = findBook(findBookID);
+            std::vector<string> readerList;
+            SharedLock lock(catalogMutex);
 
-            if(book)
+            for(size_t position = offset; position < readers.size() && readerList.size() < limit; ++position)
             {
-                foundBooks.push_back(book);
+                readerList.push_back(readers[position].getId());
             }
-            return foundBooks;
+            return readerList;
         }
 
         // Display search results
-        void displaySearchResult(const std::vector<Book*> &foundBooks)
+        void displaySearchResult(const std::vector<Book> &foundBooks) const
         {
             if(foundBooks.empty())
             {
@@ -575,179 +2833,587 @@ class Library
             for(const auto &book: foundBooks)
             {
                 cout << "--------------------------\n";
-                cout << "Book ID: " << book->getId() << '\n';
-                cout << "Title: " << book->getTitle() << '\n';
-                cout << "Author: " << book->getAuthor() << '\n';
-                cout << "Genre: " << book->getGenre() << '\n';
-                cout << "Year: "<< book->getYear() << '\n';
-                cout << "Available: " << (book->getIsAvailable() ? "Yes" : "No") << '\n';
+                cout << "Book ID: " << book.getId() << '\n';
+                cout << "Title: " << book.getTitle() << '\n';
+                cout << "Author: " << book.getAuthor() << '\n';
+                cout << "Genre: " << book.getGenre() << '\n';
+                cout << "Year: "<< book.getYear() << '\n';
+                cout << "Available: " << (book.getIsAvailable() ? "Yes" : "No") << '\n';
             }
         }
 
-        // Save library data to file
-        void saveToFile(const char *bookFileName, const char *readerFileName)
+        // Save library data to file, writing only the segments that changed since the last save, and wait for it.
+        // A save still running in the background or on the I/O thread is waited for first, so this always saves.
+        PersistStatus saveToFile(const char *bookFileName, const char *readerFileName)
         {
-            std::ofstream bookFile(bookFileName, std::ios::binary);
-            if (!bookFile.is_open())
-            {
-                cout << "Error: Failed to open book file for writing.\n";
-                return;
-            }
+            PersistReport report = saveNow(bookFileName, readerFileName);
 
-            uint32_t bookCount = static_cast<uint32_t>(books.size());
-            writeData(bookFile, bookCount);
-            cout << "Saving " << bookCount << " books to file.\n";
+            cout << "Saving " << report.books << " books to file.\n";
+            cout << "Saving " << report.readers << " readers to file.\n";
+            printSaveStatus(report.status);
+            return report.status;
+        }
 
-            for(const auto &book : books)
+        // Start saving library data in the background. The records of the changed segments are copied right away,
+        // which is the point-in-time snapshot that gets saved; encoding, writing and syncing the files then runs on a
+        // worker thread while the library stays usable. Changes made meanwhile go into the next save.
+        // Returns false if a save is still running.
+        bool startSave(const char *bookFileName, const char *readerFileName)
+        {
+            std::unique_lock<std::mutex> saving(saveMutex, std::try_to_lock);
+            if (!saving.owns_lock() || saveRunning)
             {
-                writeStringData(bookFile, book.getId());
-                writeStringData(bookFile, book.getTitle());
-                writeStringData(bookFile, book.getAuthor());
-                writeStringData(bookFile, book.getGenre());
-                writeData(bookFile, book.getYear());
-                writeData(bookFile, book.getQuantity());
-                writeData(bookFile, book.getIsAvailable());
+                return false;
             }
-            bookFile.close();
-            cout << "Books saved successfully.\n";
+            finishSaveLocked();
 
-            std::ofstream readerFile(readerFileName, std::ios::binary);
-            if (!readerFile.is_open())
+            PersistReport report;
+            stageSave(bookFileName, readerFileName, report);
+            cout << "Saving " << report.books << " books to file.\n";
+            cout << "Saving " << report.readers << " readers to file.\n";
+            saveThread = std::thread([this]
             {
-                cout << "Error: Failed to open reader file for writing.\n";
-                return;
-            }
+                writeStagedSave();
+            });
+            return true;
+        }
+
+        // Whether a background save is still writing
+        bool isSaving() const
+        {
+            return saveRunning;
+        }
 
-            uint32_t readerCount = static_cast<uint32_t>(readers.size());
-            writeData(readerFile, readerCount);
-            cout << "Saving " << readerCount << " readers to file.\n";
+        // How far the running save has got, in percent of the bytes it writes
+        int saveProgress() const
+        {
+            uint64_t total = bookSnapshot.stagedSize() + readerSnapshot.stagedSize();
+            uint64_t written = bookSnapshot.writtenSize() + readerSnapshot.writtenSize();
+
+            return total == 0 ? 100 : static_cast<int>(written * 100 / total);
+        }
+
+        // Wait for a background save to end and report how it went. Changes it failed to save stay marked for the
+        // next save. Nothing happens if no save was started since the last call.
+        void finishSave()
+        {
+            std::lock_guard<std::mutex> saving(saveMutex);
+            finishSaveLocked();
+        }
 
-            for(const auto &reader : readers)
+        // Save library data to file on the I/O thread; the future gets how it went. The caller never waits for
+        // the disk, and saveToFile, finishSave and other asynchronous saves and loads run after it.
+        std::future<PersistReport> saveAsync(const string &bookFileName, const string &readerFileName)
+        {
+            return io.submit([this, bookFileName, readerFileName]
             {
-                writeStringData(readerFile, reader.getId());
-                writeStringData(readerFile, reader.getName());
+                return saveNow(bookFileName, readerFileName);
+            });
+        }
 
-                uint32_t borrowedCount = static_cast<uint32_t>(reader.getBorrowedBooks().size());
-                writeData(readerFile, borrowedCount);
-                for(const auto &bookID : reader.getBorrowedBooks())
-                {
-                    writeStringData(readerFile, bookID);
-                }
-            }
-            readerFile.close();
-            cout << "Readers saved successfully.\n";
+        // saveAsync, calling done on the I/O thread when the save ends
+        void saveAsync(const string &bookFileName, const string &readerFileName, std::function<void(const PersistReport &)> done)
+        {
+            io.submit([this, bookFileName, readerFileName, done]
+            {
+                done(saveNow(bookFileName, readerFileName));
+            });
         }
 
-        // Load library data from file
-        void loadFromFile(const char *bookFileName, const char *readerFileName)
+        private:
+        // finishSave, with saveMutex held by the caller
+        void finishSaveLocked()
         {
-            std::ifstream inBookFile(bookFileName, std::ios::binary);
-            if (!inBookFile.is_open())
+            if (!saveThread.joinable())
             {
-                cout << "Error: Failed to open book file for reading.\n";
                 return;
             }
+            saveThread.join();
+            printSaveStatus(settleSave());
+        }
 
-            uint32_t bookCount;
-            if (!readData(inBookFile, bookCount))
+        // Tell how a save went
+        static void printSaveStatus(PersistStatus status)
+        {
+            if (status == PERSIST_BOOKS_NOT_WRITTEN)
             {
-                cout << "Error: Failed to read book count.\n";
-                inBookFile.close();
+                cout << "Error: Failed to write book file.\n";
                 return;
             }
-            cout << "Loading " << bookCount << " books from file.\n";
+            cout << "Books saved successfully.\n";
 
-            if(bookCount < 0 || bookCount > 1000000)
+            if (status == PERSIST_READERS_NOT_WRITTEN)
             {
-                cout << "Error: Book count is invalid, possible file corruption.\n";
-                inBookFile.close();
+                cout << "Error: Failed to write reader file.\n";
                 return;
             }
+            cout << "Readers saved successfully.\n";
 
-            for(int i = 0; i < bookCount; ++i)
+            if (status == PERSIST_JOURNAL_NOT_CLEARED)
             {
-                string bookID, title, author, genre;
-                int year, quantity;
-                bool isAvailable;
+                cout << "Error: Failed to clear journal.\n";
+            }
+        }
 
-                if (!readStringData(inBookFile, bookID) ||
-                    !readStringData(inBookFile, title) ||
-                    !readStringData(inBookFile, author) ||
-                    !readStringData(inBookFile, genre) ||
-                    !readData(inBookFile, year) ||
-                    !readData(inBookFile, quantity) ||
-                    !readData(inBookFile, isAvailable))
-                {
-                    cout << "Error: Failed to read book data.\n";
-                    inBookFile.close();
-                    return;
-                }
+        // Copy the records of the changed segments, with saveMutex held and no save running; this is the point-in-time
+        // snapshot that gets saved. Report gets the number of books and readers saved.
+        void stageSave(const char *bookFileName, const char *readerFileName, PersistReport &report)
+        {
+            ExclusiveLock lock(catalogMutex);
 
-                books.push_back(Book(bookID, title, author, genre, year, quantity, isAvailable));
+            // A whole-file rewrite encodes every book and replaces the loaded file, which book strings may still point
+            // into. Cutting a torn tail off the file before appending needs it unmapped too, as Windows cannot resize
+            // a mapped file.
+            bool rewritingBooks = bookSnapshot.willRewrite(bookFileName);
+            if (rewritingBooks || bookSnapshot.appendResizes(bookFileName))
+            {
+                loadAllBooks();
+                finishLazyLoading();
+                books.releaseFiles();
             }
-            inBookFile.close();
-            cout << "Books loaded successfully.\n";
 
-            std::ifstream inReaderFile(readerFileName, std::ios::binary);
-            if (!inReaderFile.is_open())
+            report.books = books.size();
+            report.readers = readers.size();
+            savingBookFile = bookFileName;
+            savingReaderFile = readerFileName;
+            copySavedRecords(rewritingBooks, readerSnapshot.willRewrite(readerFileName));
+
+            savingBookSegments = bookSegments.dirtyFlags();
+            savingReaderSegments = readerSegments.dirtyFlags();
+            bookSegments.clearDirty();
+            readerSegments.clearDirty();
+
+            // Mark where the copied state stands in the journal. The fingerprints of the new versions are only known
+            // once they are encoded, so the checkpoint naming them comes later and points back here.
+            ByteWriter record;
+            writeData(record, ++saveNumber);
+            saveCheckpoint = logOperation(LOG_SAVE_POINT, record, false);
+            saveRunning = true;
+        }
+
+        // Encode and write the copied records: both files get their new version written and synced before either
+        // is switched over
+        void writeStagedSave()
+        {
+            bookSnapshot.stage(savingBookFile.c_str(), savedBooks.size(), savingBookSegments, [this](uint32_t segment, ByteWriter &file)
             {
-                cout << "Error: Failed to open reader file for reading.\n";
-                return;
+                return encodeBookSegment(savedBooks[segment], file);
+            });
+            readerSnapshot.stage(savingReaderFile.c_str(), savedReaders.size(), savingReaderSegments, [this](uint32_t segment, ByteWriter &file)
+            {
+                return encodeReaderSegment(savedReaders[segment], file);
+            });
+            std::vector<std::vector<Book>>().swap(savedBooks);
+            std::vector<SavedReaders>().swap(savedReaders);
+
+            // The checkpoint has to be on disk before either file is switched in: if we crash after that, replay
+            // sees which checkpoint a file matches and skips what is already in it
+            ByteWriter record;
+            writeData(record, bookSnapshot.preparedFingerprint());
+            writeData(record, readerSnapshot.preparedFingerprint());
+            writeData(record, saveNumber);
+            uint64_t checkpoint = logOperation(LOG_CHECKPOINT, record, false);
+
+            bool written = bookSnapshot.write() && readerSnapshot.write() && (checkpoint == 0 || journal.waitDurable(checkpoint));
+            bookFileSaved = written && bookSnapshot.commit();
+            readerFileSaved = bookFileSaved && readerSnapshot.commit();
+            saveRunning = false;
+        }
+
+        // Take in how writing the staged save went. Changes it failed to save stay marked for the next save.
+        PersistStatus settleSave()
+        {
+            ExclusiveLock lock(catalogMutex);
+
+            if (!bookFileSaved)
+            {
+                bookSegments.markDirty(savingBookSegments);
+                readerSegments.markDirty(savingReaderSegments);
+                return PERSIST_BOOKS_NOT_WRITTEN;
+            }
+            // Rewritten segments are no longer where the lazily loaded file has them
+            for(size_t segment = 0; segment < segmentPristine.size(); ++segment)
+            {
+                segmentPristine[segment] = segmentPristine[segment] && !(segment < savingBookSegments.size() && savingBookSegments[segment]);
             }
 
-            uint32_t readerCount;
-            if (!readData(inReaderFile, readerCount))
+            if (!readerFileSaved)
             {
-                cout << "Error: Failed to read reader count.\n";
-                inReaderFile.close();
-                return;
+                readerSegments.markDirty(savingReaderSegments);
+                return PERSIST_READERS_NOT_WRITTEN;
             }
-            cout << "Loading " << readerCount << " readers from file.\n";
 
-            if (readerCount < 0 || readerCount > 1000000)
+            if (journal.isOpen() && saveCheckpoint != 0 && !journal.resetThrough(saveCheckpoint))
             {
-                cout << "Error: Reader count is invalid, possible file corruption.\n";
-                inReaderFile.close();
-                return;
+                return PERSIST_JOURNAL_NOT_CLEARED;
             }
+            return PERSIST_OK;
+        }
+
+        // A whole save on the calling thread (the I/O thread for saveAsync). A background save started before it is
+        // finished first.
+        PersistReport saveNow(const string &bookFileName, const string &readerFileName)
+        {
+            auto started = std::chrono::steady_clock::now();
+            PersistReport report;
+            std::lock_guard<std::mutex> saving(saveMutex);
+
+            finishSaveLocked();
+            stageSave(bookFileName.c_str(), readerFileName.c_str(), report);
+            writeStagedSave();
+            report.status = settleSave();
+            report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+            return report;
+        }
 
-            for(int i = 0; i < readerCount; ++i)
+        public:
+        // Replay the journal on top of the loaded files, then keep it open to record every further change.
+        // Like loading, this sets the library up and must be done before other threads use it.
+        bool openJournal(const char *journalFileName)
+        {
+            size_t validLength = 0;
+            size_t replayed = 0;
             {
-                string readerID, name;
-                uint32_t borrowedCount;
+                MappedFile journalData;
+                if (journalData.open(journalFileName))
+                {
+                    // Each file already holds everything up to the save point of the last checkpoint matching it (a
+                    // save point compacted away means the whole journal is newer). A save commits the book file before
+                    // the reader file, so the reader file is never ahead of the book file; a crash in between leaves
+                    // changes to redo on the reader side only.
+                    std::vector<size_t> bookMatches, readerMatches;
+                    std::unordered_map<uint32_t, size_t> savePoints;
+                    size_t index = 0;
+                    Journal::forEachRecord(journalData.data(), journalData.size(), [&](uint8_t operation, ByteReader record)
+                    {
+                        uint32_t bookChecksum, readerChecksum, number;
+
+                        ++index;
+                        if (operation == LOG_SAVE_POINT && readData(record, number))
+                        {
+                            savePoints[number] = index;
+                        }
+                        else if (operation == LOG_CHECKPOINT && readData(record, bookChecksum) && readData(record, readerChecksum))
+                        {
+                            // Checkpoints written before save points existed stand where their save was copied
+                            size_t savedThrough = index;
+                            if (readData(record, number))
+                            {
+                                auto savePoint = savePoints.find(number);
+                                savedThrough = savePoint != savePoints.end() ? savePoint->second : 0;
+                            }
+
+                            if (bookChecksum == bookSnapshot.fingerprint())
+                            {
+                                bookMatches.push_back(savedThrough);
+                            }
+                            if (readerChecksum == readerSnapshot.fingerprint())
+                            {
+                                readerMatches.push_back(savedThrough);
+                            }
+                        }
+                    });
+
+                    size_t bookSkip = bookMatches.empty() ? 0 : bookMatches.back();
+                    size_t readerSkip = 0;
+                    for (size_t match : readerMatches)
+                    {
+                        if (match <= bookSkip)
+                        {
+                            readerSkip = match;
+                        }
+                    }
+
+                    index = 0;
+                    replaying = true;
+                    validLength = Journal::forEachRecord(journalData.data(), journalData.size(), [&](uint8_t operation, ByteReader record)
+                    {
+                        if (++index > readerSkip && operation != LOG_CHECKPOINT && operation != LOG_SAVE_POINT)
+                        {
+                            bool applied = index > bookSkip ? applyJournalRecord(operation, record) : applyJournalRecordToReaders(operation, record);
+                            if (!applied)
+                            {
+                                cout << "Warning: Journal record " << index << " could not be applied.\n";
+                            }
+                            ++replayed;
+                        }
+                    });
+                    replaying = false;
+
+                    // Parts of a batch whose final record never made it were not applied
+                    replayedBatch.clear();
+                }
+            }
 
-                if (!readStringData(inReaderFile, readerID) ||
-                    !readStringData(inReaderFile, name) ||
-                    !readData(inReaderFile, borrowedCount))
+            if (!journal.open(journalFileName, validLength))
+            {
+                cout << "Error: Failed to open journal file.\n";
+                return false;
+            }
+            if (replayed > 0)
+            {
+                cout << "Replayed " << replayed << " changes from the journal.\n";
+            }
+            return true;
+        }
+
+        // Import books from a CSV or JSON Lines feed (told apart by the file extension), streaming it in chunks.
+        // Records are checked as they come; valid ones are inserted in batches, each indexed and journaled at once.
+        // Rejected records are counted in the report with the reason for the first few.
+        // Returns false if the feed cannot be opened or read to the end (books inserted until then are kept).
+        bool importBooks(const char *feedFileName, ImportReport &report)
+        {
+            auto started = std::chrono::steady_clock::now();
+            FeedReader::Format format;
+            FeedReader feed;
+
+            if (!FeedReader::formatOf(feedFileName, format))
+            {
+                cout << "Error: Unknown feed format, expected a .csv or .jsonl file.\n";
+                return false;
+            }
+            if (!feed.open(feedFileName, format, {"id", "title", "author", "genre", "year", "quantity", "available"}, FEED_AVAILABLE))
+            {
+                cout << "Error: " << feed.error() << '\n';
+                return false;
+            }
+
+            // The library is locked while a batch is inserted, not while the feed is read; the batches' journal
+            // records are waited for once at the end, so they share syncs
+            FeedRecord record;
+            ByteWriter batch;
+            std::vector<size_t> rows;
+            uint64_t logged = 0;
+            ExclusiveLock lock(catalogMutex, std::defer_lock);
+            rows.reserve(IMPORT_BATCH);
+            while (feed.next(record))
+            {
+                ++report.rows;
+                if (!lock.owns_lock())
                 {
-                    cout << "Error: Failed to read reader data.\n";
-                    inReaderFile.close();
-                    return;
+                    lock.lock();
+                }
+                string problem = record.problem.empty() ? importBook(record, batch, rows) : record.problem;
+                if (!problem.empty())
+                {
+                    ++report.rejected;
+                    if (report.problems.size() < ImportReport::MAX_PROBLEMS)
+                    {
+                        report.problems.push_back("Line " + std::to_string(feed.line()) + ": " + problem);
+                    }
+                    continue;
                 }
 
-                if (borrowedCount < 0 || borrowedCount > 1000000)
+                ++report.imported;
+                if (rows.size() == IMPORT_BATCH || batch.size() >= JOURNAL_PART_SIZE)
                 {
-                    cout << "Error: Borrowed book count is invalid, possible file corruption.\n";
-                    inReaderFile.close();
-                    return;
+                    logged = (std::max)(logged, finishImportBatch(rows, batch));
+                    lock.unlock();
                 }
+            }
+            if (lock.owns_lock())
+            {
+                logged = (std::max)(logged, finishImportBatch(rows, batch));
+                lock.unlock();
+            }
+            waitLogged(logged);
+
+            report.bytes = feed.bytesRead();
+            report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+            if (!feed.error().empty())
+            {
+                cout << "Error: " << feed.error() << '\n';
+                return false;
+            }
+            return true;
+        }
+
+        // Export the books matching a query (BookQuery::all({}) for every book) to a CSV or JSON Lines file,
+        // told apart by the file extension. Records are written straight from the book store in catalog order.
+        bool exportBooks(const char *exportFileName, const BookQuery &query, ExportReport &report)
+        {
+            auto started = std::chrono::steady_clock::now();
+            FeedWriter feed;
+
+            if (!openExport(feed, exportFileName, {"id", "title", "author", "genre", "year", "quantity", "available"}))
+            {
+                return false;
+            }
+
+            UpgradableLock lock(catalogMutex);
+            lock.upgradeIf(needsDecodingAny());
+            AllStripesShared bookLock(bookLocks);
+            loadAllBooks();
+            forEachMatch(query, [this, &feed, &report](size_t row)
+            {
+                feed.field(books.getId(row));
+                feed.field(books.getTitle(row));
+                feed.field(books.getAuthor(row));
+                const string &genre = books.getGenre(row);
+                feed.field(StringRef(genre.data(), genre.size()));
+                feed.field(books.getYear(row));
+                feed.field(books.getQuantity(row));
+                feed.field(books.getIsAvailable(row));
+                feed.endRecord();
+                ++report.records;
+            });
+            return finishExport(feed, started, report);
+        }
+
+        // Export every reader with the number of books they hold to a CSV or JSON Lines file
+        bool exportReaders(const char *exportFileName, ExportReport &report)
+        {
+            auto started = std::chrono::steady_clock::now();
+            FeedWriter feed;
+
+            if (!openExport(feed, exportFileName, {"id", "name", "borrowed"}))
+            {
+                return false;
+            }
+
+            SharedLock lock(catalogMutex);
+            AllStripesShared readerLock(readerLocks);
+            for (const auto &reader : readers)
+            {
+                feed.field(StringRef(reader.getId().data(), reader.getId().size()));
+                feed.field(StringRef(reader.getName().data(), reader.getName().size()));
+                feed.field(static_cast<int>(reader.getTotalBorrowedBooks()));
+                feed.endRecord();
+                ++report.records;
+            }
+            return finishExport(feed, started, report);
+        }
+
+        // Export the active loans of books matching a query to a CSV or JSON Lines file, one record per borrowed copy,
+        // grouped by reader
+        bool exportLoans(const char *exportFileName, const BookQuery &query, ExportReport &report)
+        {
+            auto started = std::chrono::steady_clock::now();
+            bool everything = query.getKind() == BookQuery::AND && query.getChildren().empty();
+            FeedWriter feed;
 
-                std::vector<string> borrowedBooks;
-                borrowedBooks.reserve(borrowedCount);
-                for(int j = 0; j < borrowedCount; ++j)
+            if (!openExport(feed, exportFileName, {"reader_id", "reader_name", "book_id", "title"}))
+            {
+                return false;
+            }
+
+            UpgradableLock lock(catalogMutex);
+            lock.upgradeIf(needsDecodingAny());
+            AllStripesShared bookLock(bookLocks);
+            AllStripesShared readerLock(readerLocks);
+            loadAllBooks();
+            for (const auto &reader : readers)
+            {
+                for (uint32_t bookHandle : reader.getBorrowedBooks())
                 {
-                    string bookID;
-                    if (!readStringData(inReaderFile, bookID))
+                    size_t row = books.rowOf(bookHandle);
+                    if (row == BookStore::NO_ROW ? !everything : !query.matches(BookRef(&books, row)))
                     {
-                        cout << "Error: Failed to read borrowed book ID.\n";
-                        inReaderFile.close();
-                        return;
+                        continue;
                     }
-                    borrowedBooks.push_back(bookID);
+
+                    const string &bookID = bookIds.name(bookHandle);
+                    feed.field(StringRef(reader.getId().data(), reader.getId().size()));
+                    feed.field(StringRef(reader.getName().data(), reader.getName().size()));
+                    feed.field(StringRef(bookID.data(), bookID.size()));
+                    feed.field(row == BookStore::NO_ROW ? StringRef() : books.getTitle(row));
+                    feed.endRecord();
+                    ++report.records;
                 }
-                readers.push_back(Reader(readerID, name, borrowedBooks));
             }
-            inReaderFile.close();
-            cout << "Readers loaded successfully.\n";
+            return finishExport(feed, started, report);
+        }
+
+        // Load library data from file; lazily, book records are only decoded when first used
+        void loadFromFile(const char *bookFileName, const char *readerFileName, bool lazy = false)
+        {
+            switch (loadFiles(bookFileName, readerFileName, lazy))
+            {
+                case PERSIST_NO_BOOK_FILE:
+                    cout << "Error: Failed to open book file for reading.\n";
+                    break;
+                case PERSIST_NO_READER_FILE:
+                    cout << "Books loaded successfully.\n";
+                    cout << "Error: Failed to open reader file for reading.\n";
+                    break;
+                case PERSIST_BAD_READER_FILE:
+                    cout << "Books loaded successfully.\n";
+                    break;
+                case PERSIST_OK:
+                    cout << "Books loaded successfully.\n";
+                    cout << "Readers loaded successfully.\n";
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        // Load library data from file on the I/O thread; the future gets how it went. Like loadFromFile, this
+        // sets the library up: it holds the library exclusively while it runs.
+        std::future<PersistReport> loadAsync(const string &bookFileName, const string &readerFileName, bool lazy = false)
+        {
+            return io.submit([this, bookFileName, readerFileName, lazy]
+            {
+                return loadNow(bookFileName, readerFileName, lazy);
+            });
+        }
+
+        // loadAsync, calling done on the I/O thread when the load ends
+        void loadAsync(const string &bookFileName, const string &readerFileName, bool lazy, std::function<void(const PersistReport &)> done)
+        {
+            io.submit([this, bookFileName, readerFileName, lazy, done]
+            {
+                done(loadNow(bookFileName, readerFileName, lazy));
+            });
+        }
+
+        private:
+        // Load both files; what is wrong with them beyond that is reported by loadBooks and loadReaders
+        PersistStatus loadFiles(const char *bookFileName, const char *readerFileName, bool lazy)
+        {
+            ExclusiveLock lock(catalogMutex);
+            std::shared_ptr<MappedFile> bookData = std::make_shared<MappedFile>();
+            if (!bookData->open(bookFileName))
+            {
+                return PERSIST_NO_BOOK_FILE;
+            }
+
+            // Loaded book strings point into the mapping, so the book store keeps it open
+            books.holdFile(bookData);
+
+            if (!loadBooks(bookFileName, bookData, lazy))
+            {
+                return PERSIST_BAD_BOOK_FILE;
+            }
+
+            MappedFile readerData;
+            if (!readerData.open(readerFileName))
+            {
+                return PERSIST_NO_READER_FILE;
+            }
+
+            if (!loadReaders(readerFileName, readerData))
+            {
+                return PERSIST_BAD_READER_FILE;
+            }
+            return PERSIST_OK;
         }
-};
\ No newline at end of file
+
+        // A whole load, run on the I/O thread
+        PersistReport loadNow(const string &bookFileName, const string &readerFileName, bool lazy)
+        {
+            auto started = std::chrono::steady_clock::now();
+            PersistReport report;
+
+            report.status = loadFiles(bookFileName.c_str(), readerFileName.c_str(), lazy);
+            SharedLock lock(catalogMutex);
+            report.books = books.size();
+            report.readers = readers.size();
+            report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+            return report;
+        }
+};
+
+const size_t Library::NO_POSITION;
+const size_t Library::IMPORT_BATCH;
+const size_t Library::JOURNAL_PART_SIZE;
\ No newline at end of file
@@ -0,0 +1,339 @@
+#pragma once
+#ifndef _WIN32
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <csignal>
+#include "Protocol.cpp"
+#include "Socket.cpp"
+
+using std::cout;
+using std::string;
+
+// Load generator for LibraryServer: many connections on one event loop, each keeping a number of requests in
+// flight (pipelined), for a fixed time. Reports requests per second and the latency distribution.
+// The mix is mostly lookups, plus borrows each followed by the matching return, on books and readers
+// listed from the server first.
+class LoadGenerator
+{
+    private:
+        static const int ID_SAMPLE = 1000;
+
+        typedef std::chrono::steady_clock Clock;
+
+        struct Client
+        {
+            int fd;
+            string input;
+            string output;
+            size_t written = 0;
+            bool writing = true;
+            std::deque<Clock::time_point> sent;
+            string borrowedBook;        // returned by the client's next request
+            string borrower;
+            uint64_t random;
+        };
+
+        std::vector<string> bookIds;
+        std::vector<string> readerIds;
+        std::vector<uint32_t> latencies;        // microseconds, one per response
+        uint64_t succeeded = 0;
+        uint64_t refused = 0;                   // answered with an error status
+        uint64_t broken = 0;                    // connections lost
+
+        static uint32_t nextRandom(uint64_t &state)
+        {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            return static_cast<uint32_t>(state >> 32);
+        }
+
+        // Send one request on a blocking socket and wait for its response body; false if the connection fails
+        static bool roundTrip(int fd, const string &request, string &response)
+        {
+            size_t written = 0;
+            string input;
+
+            while(written < request.size())
+            {
+                ssize_t sent = send(fd, request.data() + written, request.size() - written, 0);
+                if(sent <= 0)
+                {
+                    return false;
+                }
+                written += static_cast<size_t>(sent);
+            }
+            for(;;)
+            {
+                size_t length = Protocol::frameLength(input.data(), input.size(), Protocol::MAX_RESPONSE);
+                if(length == SIZE_MAX)
+                {
+                    return false;
+                }
+                if(length > 0)
+                {
+                    response = input.substr(4, length - 4);
+                    return true;
+                }
+
+                char chunk[64 * 1024];
+                ssize_t received = recv(fd, chunk, sizeof(chunk), 0);
+                if(received <= 0)
+                {
+                    return false;
+                }
+                input.append(chunk, static_cast<size_t>(received));
+            }
+        }
+
+        // Fetch up to ID_SAMPLE IDs with a LIST_BOOKS or LIST_READERS request
+        static bool listIds(int fd, Protocol::Request request, std::vector<string> &ids)
+        {
+            string message, response;
+            size_t frame = Protocol::beginFrame(message);
+            Protocol::putByte(message, request);
+            Protocol::putInt(message, 0);
+            Protocol::putInt(message, ID_SAMPLE);
+            Protocol::endFrame(message, frame);
+
+            if(!roundTrip(fd, message, response))
+            {
+                return false;
+            }
+
+            ByteReader body(response.data(), response.size());
+            uint8_t status;
+            int count;
+            if(!Protocol::getByte(body, status) || status != BATCH_OK || !Protocol::getInt(body, count))
+            {
+                return false;
+            }
+            ids.resize(count);
+            for(auto &id : ids)
+            {
+                if(!Protocol::getString(body, id))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // Queue the client's next request
+        void issue(Client &client)
+        {
+            size_t frame = Protocol::beginFrame(client.output);
+            uint32_t choice = nextRandom(client.random) % 100;
+            const string &book = bookIds[nextRandom(client.random) % bookIds.size()];
+            const string &reader = readerIds[nextRandom(client.random) % readerIds.size()];
+
+            if(!client.borrowedBook.empty())
+            {
+                Protocol::putByte(client.output, Protocol::RETURN);
+                Protocol::putString(client.output, client.borrowedBook);
+                Protocol::putString(client.output, client.borrower);
+                client.borrowedBook.clear();
+            }
+            else if(choice < 60)
+            {
+                Protocol::putByte(client.output, Protocol::FIND_BOOK);
+                Protocol::putString(client.output, book);
+            }
+            else if(choice < 75)
+            {
+                Protocol::putByte(client.output, Protocol::IS_BORROWED);
+                Protocol::putString(client.output, book);
+            }
+            else if(choice < 85)
+            {
+                Protocol::putByte(client.output, Protocol::READER_LOANS);
+                Protocol::putString(client.output, reader);
+            }
+            else
+            {
+                Protocol::putByte(client.output, Protocol::BORROW);
+                Protocol::putString(client.output, book);
+                Protocol::putString(client.output, reader);
+                client.borrowedBook = book;
+                client.borrower = reader;
+            }
+            Protocol::endFrame(client.output, frame);
+            client.sent.push_back(Clock::now());
+        }
+
+        // Take the complete responses a client has received, recording their latency
+        void collect(Client &client)
+        {
+            size_t consumed = 0;
+            Clock::time_point now = Clock::now();
+
+            for(;;)
+            {
+                size_t length = Protocol::frameLength(client.input.data() + consumed, client.input.size() - consumed, Protocol::MAX_RESPONSE);
+                if(length == 0 || length == SIZE_MAX || client.sent.empty())
+                {
+                    break;
+                }
+
+                uint8_t status = length > 4 ? static_cast<uint8_t>(client.input[consumed + 4]) : Protocol::BAD_REQUEST;
+                ++(status == BATCH_OK ? succeeded : refused);
+                latencies.push_back(static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(now - client.sent.front()).count()));
+                client.sent.pop_front();
+                consumed += length;
+                issue(client);
+            }
+            client.input.erase(0, consumed);
+        }
+
+        static double percentile(const std::vector<uint32_t> &sorted, double fraction)
+        {
+            if(sorted.empty())
+            {
+                return 0;
+            }
+            return sorted[(std::min)(sorted.size() - 1, static_cast<size_t>(fraction * sorted.size()))] / 1000.0;
+        }
+
+    public:
+        LoadGenerator(){};
+
+        // Run clients connections, each with depth requests in flight, against a server for a number of seconds
+        bool run(const string &address, size_t clients, size_t depth, int seconds)
+        {
+            SocketAddress where;
+            EventPoller poller;
+            string error;
+
+            if(!where.parse(address, error))
+            {
+                cout << "Error: " << error << '\n';
+                return false;
+            }
+            std::signal(SIGPIPE, SIG_IGN);
+            Socket::raiseFileLimit();
+
+            int probe = Socket::connectTo(where, error);
+            if(probe < 0)
+            {
+                cout << "Error: " << error << '\n';
+                return false;
+            }
+            bool listed = listIds(probe, Protocol::LIST_BOOKS, bookIds) && listIds(probe, Protocol::LIST_READERS, readerIds);
+            close(probe);
+            if(!listed || bookIds.empty() || readerIds.empty())
+            {
+                cout << "Error: The server has no books or no readers to run the load against.\n";
+                return false;
+            }
+
+            std::vector<std::unique_ptr<Client>> connections;
+            if(!poller.open())
+            {
+                cout << "Error: Cannot start the event loop.\n";
+                return false;
+            }
+            for(size_t i = 0; i < clients; ++i)
+            {
+                int fd = Socket::connectTo(where, error);
+                if(fd < 0 || !Socket::setNonBlocking(fd))
+                {
+                    cout << "Error: " << error << " (after " << i << " connections)\n";
+                    break;
+                }
+                if(static_cast<size_t>(fd) >= connections.size())
+                {
+                    connections.resize(fd + 1);
+                }
+                connections[fd].reset(new Client());
+                connections[fd]->fd = fd;
+                connections[fd]->random = 0x9E3779B97F4A7C15ull * (i + 1);
+                poller.watch(fd, true, true);
+            }
+
+            size_t open = 0;
+            for(auto &client : connections)
+            {
+                if(client)
+                {
+                    ++open;
+                    for(size_t i = 0; i < depth; ++i)
+                    {
+                        issue(*client);
+                    }
+                }
+            }
+            cout << "Running " << open << " connections with " << depth << " requests in flight each for " << seconds << " s...\n";
+
+            Clock::time_point started = Clock::now();
+            Clock::time_point deadline = started + std::chrono::seconds(seconds);
+            std::vector<EventPoller::Event> events;
+            while(open > 0 && Clock::now() < deadline)
+            {
+                poller.wait(events, 100);
+                for(const auto &event : events)
+                {
+                    Client *client = connections[event.fd].get();
+                    if(client == nullptr)
+                    {
+                        continue;
+                    }
+
+                    bool alive = true;
+                    if(event.readable)
+                    {
+                        alive = Socket::receiveSome(client->fd, client->input, 256 * 1024);
+                        collect(*client);
+                    }
+                    alive = alive && Socket::sendSome(client->fd, client->output, client->written);
+                    if(client->written == client->output.size())
+                    {
+                        client->output.clear();
+                        client->written = 0;
+                    }
+                    if(!alive)
+                    {
+                        ++broken;
+                        --open;
+                        poller.forget(client->fd);
+                        close(client->fd);
+                        connections[event.fd].reset();
+                        continue;
+                    }
+                    bool writing = client->written < client->output.size();
+                    if(writing != client->writing)
+                    {
+                        client->writing = writing;
+                        poller.watch(client->fd, true, writing);
+                    }
+                }
+            }
+            double elapsed = std::chrono::duration<double>(Clock::now() - started).count();
+
+            for(auto &client : connections)
+            {
+                if(client)
+                {
+                    close(client->fd);
+                }
+            }
+
+            std::sort(latencies.begin(), latencies.end());
+            cout << "Requests:   " << latencies.size() << " (" << succeeded << " OK, " << refused << " refused), "
+                 << broken << " connections lost\n";
+            cout << "Throughput: " << static_cast<uint64_t>(latencies.size() / elapsed) << " requests/s\n";
+            cout.setf(std::ios::fixed);
+            cout.precision(3);
+            cout << "Latency ms: p50 " << percentile(latencies, 0.50) << ", p99 " << percentile(latencies, 0.99)
+                 << ", p99.9 " << percentile(latencies, 0.999) << ", max " << percentile(latencies, 1.0) << '\n';
+            return true;
+        }
+};
+
+const int LoadGenerator::ID_SAMPLE;
+#endif
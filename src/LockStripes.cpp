@@ -0,0 +1,118 @@
+#pragma once
+#include <mutex>
+#include <shared_mutex>
+#include <cstdint>
+#include <cstddef>
+
+// A fixed set of reader/writer locks that keys (book or reader handles) are spread over, so work on different
+// keys mostly takes different locks. Several stripes are always taken in ascending order.
+class LockStripes
+{
+    public:
+        static const size_t COUNT = 64;
+
+    private:
+        mutable std::shared_timed_mutex locks[COUNT];
+
+    public:
+        LockStripes(){};
+
+        LockStripes(const LockStripes &) = delete;
+        LockStripes &operator=(const LockStripes &) = delete;
+
+        size_t stripeOf(uint32_t key) const
+        {
+            return key % COUNT;
+        }
+
+        std::shared_timed_mutex &of(uint32_t key) const
+        {
+            return locks[stripeOf(key)];
+        }
+
+        // Take every stripe shared, to read all keys at once
+        void lockAllShared() const
+        {
+            for(auto &lock : locks)
+            {
+                lock.lock_shared();
+            }
+        }
+
+        void unlockAllShared() const
+        {
+            for(size_t stripe = COUNT; stripe-- > 0; )
+            {
+                locks[stripe].unlock_shared();
+            }
+        }
+};
+
+// Holds every stripe of a set shared for as long as it lives
+class AllStripesShared
+{
+    private:
+        const LockStripes &stripes;
+
+    public:
+        explicit AllStripesShared(const LockStripes &stripes): stripes(stripes)
+        {
+            stripes.lockAllShared();
+        }
+
+        AllStripesShared(const AllStripesShared &) = delete;
+        AllStripesShared &operator=(const AllStripesShared &) = delete;
+
+        ~AllStripesShared()
+        {
+            stripes.unlockAllShared();
+        }
+};
+
+// Lock on a reader/writer mutex that starts out shared and can be switched to exclusive
+class UpgradableLock
+{
+    private:
+        std::shared_timed_mutex &mutex;
+        bool exclusive;
+
+    public:
+        explicit UpgradableLock(std::shared_timed_mutex &mutex): mutex(mutex), exclusive(false)
+        {
+            mutex.lock_shared();
+        }
+
+        UpgradableLock(const UpgradableLock &) = delete;
+        UpgradableLock &operator=(const UpgradableLock &) = delete;
+
+        ~UpgradableLock()
+        {
+            if(exclusive)
+            {
+                mutex.unlock();
+            }
+            else
+            {
+                mutex.unlock_shared();
+            }
+        }
+
+        // Switch to exclusive if the condition holds. The shared lock is let go first, so anything looked up
+        // under it has to be looked up again.
+        void upgradeIf(bool condition)
+        {
+            if(condition && !exclusive)
+            {
+                mutex.unlock_shared();
+                mutex.lock();
+                exclusive = true;
+            }
+        }
+
+        bool isExclusive() const
+        {
+            return exclusive;
+        }
+};
+
+const size_t LockStripes::COUNT;
@@ -0,0 +1,230 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstring>
+#include <cstdint>
+#include <fstream>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "StringArena.cpp"
+
+// A whole file mapped read-only into memory, so records can be parsed in place and
+// string fields can point straight into it. Where mapping is not possible the file is read into memory instead.
+class MappedFile
+{
+    private:
+        const char *bytes = nullptr;
+        size_t length = 0;
+        std::vector<char> buffer;   // fallback copy when the file could not be mapped
+        bool mapped = false;
+
+#ifdef _WIN32
+        HANDLE file = INVALID_HANDLE_VALUE;
+        HANDLE mapping = nullptr;
+#endif
+
+        bool map(const char *fileName)
+        {
+#ifdef _WIN32
+            file = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+            if(file == INVALID_HANDLE_VALUE)
+            {
+                return false;
+            }
+
+            LARGE_INTEGER fileSize;
+            if(!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+            {
+                return false;
+            }
+
+            mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if(mapping == nullptr)
+            {
+                return false;
+            }
+
+            const void *view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            if(view == nullptr)
+            {
+                return false;
+            }
+            bytes = static_cast<const char*>(view);
+            length = static_cast<size_t>(fileSize.QuadPart);
+#else
+            int descriptor = ::open(fileName, O_RDONLY);
+            if(descriptor < 0)
+            {
+                return false;
+            }
+
+            struct stat status;
+            if(fstat(descriptor, &status) != 0 || status.st_size == 0)
+            {
+                ::close(descriptor);
+                return false;
+            }
+
+            void *view = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_PRIVATE, descriptor, 0);
+            ::close(descriptor);
+            if(view == MAP_FAILED)
+            {
+                return false;
+            }
+            // Records are parsed front to back
+            madvise(view, static_cast<size_t>(status.st_size), MADV_SEQUENTIAL);
+
+            bytes = static_cast<const char*>(view);
+            length = static_cast<size_t>(status.st_size);
+#endif
+            mapped = true;
+            return true;
+        }
+
+        void unmap()
+        {
+#ifdef _WIN32
+            if(mapped)
+            {
+                UnmapViewOfFile(bytes);
+            }
+            if(mapping != nullptr)
+            {
+                CloseHandle(mapping);
+                mapping = nullptr;
+            }
+            if(file != INVALID_HANDLE_VALUE)
+            {
+                CloseHandle(file);
+                file = INVALID_HANDLE_VALUE;
+            }
+#else
+            if(mapped)
+            {
+                munmap(const_cast<char*>(bytes), length);
+            }
+#endif
+            mapped = false;
+            bytes = nullptr;
+            length = 0;
+        }
+
+        bool readWhole(const char *fileName)
+        {
+            std::ifstream input(fileName, std::ios::binary | std::ios::ate);
+            if(!input.is_open())
+            {
+                return false;
+            }
+
+            std::streamoff fileSize = input.tellg();
+            if(fileSize < 0)
+            {
+                return false;
+            }
+
+            buffer.resize(static_cast<size_t>(fileSize));
+            input.seekg(0);
+            if(fileSize > 0 && !input.read(&buffer[0], fileSize))
+            {
+                return false;
+            }
+            bytes = buffer.data();
+            length = buffer.size();
+            return true;
+        }
+
+    public:
+        MappedFile(){};
+
+        MappedFile(const MappedFile &) = delete;
+        MappedFile &operator=(const MappedFile &) = delete;
+
+        ~MappedFile()
+        {
+            unmap();
+        }
+
+        // Map a file, falling back to reading it whole; false if it cannot be opened
+        bool open(const char *fileName)
+        {
+            unmap();
+            if(map(fileName))
+            {
+                return true;
+            }
+            unmap();
+            return readWhole(fileName);
+        }
+
+        const char *data() const
+        {
+            return bytes;
+        }
+
+        size_t size() const
+        {
+            return length;
+        }
+
+        bool isMapped() const
+        {
+            return mapped;
+        }
+};
+
+// Bounds-checked reader over bytes in memory, in the same layout ifstream::read would see
+class ByteReader
+{
+    private:
+        const char *cursor;
+        const char *end;
+
+    public:
+        ByteReader(const char *data, size_t size): cursor(data), end(data + size) {};
+
+        // Copy a fixed-size value out of the buffer
+        template<typename T>
+        bool read(T &data)
+        {
+            if(static_cast<size_t>(end - cursor) < sizeof(data))
+            {
+                return false;
+            }
+            std::memcpy(&data, cursor, sizeof(data));
+            cursor += sizeof(data);
+            return true;
+        }
+
+        // Take the next bytes of the buffer without copying them
+        bool take(size_t size, StringRef &data)
+        {
+            if(static_cast<size_t>(end - cursor) < size)
+            {
+                return false;
+            }
+            data = StringRef(cursor, size);
+            cursor += size;
+            return true;
+        }
+
+        size_t remaining() const
+        {
+            return end - cursor;
+        }
+};
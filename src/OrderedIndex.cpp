@@ -0,0 +1,184 @@
+#pragma once
+#include <vector>
+#include <map>
+#include <set>
+#include <algorithm>
+#include <cstdint>
+
+// Ordered secondary index from an integer field (e.g. publication year) to record handles.
+// Records are bucketed per key in a sorted map, so range scans and top-k walks start in O(log n).
+// Range counts use a Fenwick tree over the distinct keys, rebuilt only when a new distinct key shows up.
+class OrderedIndex
+{
+    private:
+        std::map<int, std::set<uint32_t>> buckets;
+        std::vector<int> keys;      // distinct keys ever seen, sorted
+        std::vector<size_t> tree;   // Fenwick tree of bucket sizes over keys
+        size_t total = 0;
+
+        // Add a delta to the count of the key at a position in keys
+        void adjust(size_t position, long long delta)
+        {
+            for(size_t i = position + 1; i <= tree.size(); i += i & (~i + 1))
+            {
+                tree[i - 1] += delta;
+            }
+        }
+
+        // Number of records with a key at a position below the given one
+        size_t prefixCount(size_t position) const
+        {
+            size_t count = 0;
+
+            for(size_t i = position; i > 0; i -= i & (~i + 1))
+            {
+                count += tree[i - 1];
+            }
+            return count;
+        }
+
+        // Rebuild the Fenwick tree after a new distinct key was added
+        void rebuildTree()
+        {
+            tree.assign(keys.size(), 0);
+
+            for(size_t i = 0; i < keys.size(); ++i)
+            {
+                auto bucket = buckets.find(keys[i]);
+                if(bucket != buckets.end())
+                {
+                    tree[i] += bucket->second.size();
+                }
+
+                size_t parent = i + ((i + 1) & (~(i + 1) + 1));
+                if(parent < tree.size())
+                {
+                    tree[parent] += tree[i];
+                }
+            }
+        }
+
+        // Position of a key in keys (the key must be present)
+        size_t keyPosition(int key) const
+        {
+            return std::lower_bound(keys.begin(), keys.end(), key) - keys.begin();
+        }
+
+    public:
+        OrderedIndex(){};
+
+        // Add a record under a key
+        void insert(int key, uint32_t handle)
+        {
+            if(!buckets[key].insert(handle).second)
+            {
+                return;
+            }
+            ++total;
+
+            size_t position = keyPosition(key);
+            if(position == keys.size() || keys[position] != key)
+            {
+                keys.insert(keys.begin() + position, key);
+                rebuildTree();
+                return;
+            }
+            adjust(position, 1);
+        }
+
+        // Remove a record from under a key
+        void erase(int key, uint32_t handle)
+        {
+            auto bucket = buckets.find(key);
+
+            if(bucket == buckets.end() || bucket->second.erase(handle) == 0)
+            {
+                return;
+            }
+            --total;
+
+            if(bucket->second.empty())
+            {
+                buckets.erase(bucket);
+            }
+            adjust(keyPosition(key), -1);
+        }
+
+        // Remove every record
+        void clear()
+        {
+            buckets.clear();
+            keys.clear();
+            tree.clear();
+            total = 0;
+        }
+
+        // Number of indexed records
+        size_t size() const
+        {
+            return total;
+        }
+
+        // Number of records with from <= key <= to
+        size_t count(int from, int to) const
+        {
+            if(from > to)
+            {
+                return 0;
+            }
+
+            size_t first = std::lower_bound(keys.begin(), keys.end(), from) - keys.begin();
+            size_t last = std::upper_bound(keys.begin(), keys.end(), to) - keys.begin();
+            return prefixCount(last) - prefixCount(first);
+        }
+
+        // Call a function for every record handle with from <= key <= to, in ascending key order
+        template<typename F>
+        void forEachInRange(int from, int to, F function) const
+        {
+            if(from > to)
+            {
+                return;
+            }
+
+            for(auto it = buckets.lower_bound(from); it != buckets.end() && it->first <= to; ++it)
+            {
+                for(const auto &handle : it->second)
+                {
+                    function(handle);
+                }
+            }
+        }
+
+        // Handles of records with from <= key <= to, in ascending key order
+        std::vector<uint32_t> range(int from, int to) const
+        {
+            std::vector<uint32_t> handles;
+
+            handles.reserve(count(from, to));
+            forEachInRange(from, to, [&handles](uint32_t handle)
+            {
+                handles.push_back(handle);
+            });
+            return handles;
+        }
+
+        // Handles of the k records with the largest keys, largest first
+        std::vector<uint32_t> top(size_t k) const
+        {
+            std::vector<uint32_t> handles;
+
+            for(auto it = buckets.rbegin(); it != buckets.rend() && handles.size() < k; ++it)
+            {
+                for(const auto &handle : it->second)
+                {
+                    if(handles.size() == k)
+                    {
+                        break;
+                    }
+                    handles.push_back(handle);
+                }
+            }
+            return handles;
+        }
+};
\ No newline at end of file
@@ -0,0 +1,55 @@
+#pragma once
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+
+// Spreads independent pieces of work over the cores of the machine
+class Parallel
+{
+    public:
+        // Number of threads worth running at once
+        static size_t threadCount()
+        {
+            unsigned cores = std::thread::hardware_concurrency();
+
+            return cores == 0 ? 1 : cores;
+        }
+
+        // Call work(i) for every i in [0, count), each exactly once, on up to threadCount() threads
+        // (the calling thread included); returns when all calls are done
+        template<typename F>
+        static void forEach(size_t count, F work)
+        {
+            std::atomic<size_t> next(0);
+            auto worker = [&next, count, &work]
+            {
+                for(size_t i = next++; i < count; i = next++)
+                {
+                    work(i);
+                }
+            };
+
+            std::vector<std::thread> helpers;
+            size_t threads = (std::min)(threadCount(), count);
+            for(size_t i = 1; i < threads; ++i)
+            {
+                helpers.emplace_back(worker);
+            }
+            worker();
+            for(auto &helper : helpers)
+            {
+                helper.join();
+            }
+        }
+
+        // Run different tasks at the same time and wait for all of them
+        static void invoke(const std::vector<std::function<void()>> &tasks)
+        {
+            forEach(tasks.size(), [&tasks](size_t i)
+            {
+                tasks[i]();
+            });
+        }
+};
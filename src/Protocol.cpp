@@ -0,0 +1,134 @@
+#pragma once
+#include <string>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include "MappedFile.cpp"
+
+using std::string;
+
+// Wire format of the library server. Every request and response is a frame: a 4-byte little-endian body length,
+// then the body. A request body is a request code and its fields; a response body is a status and the result
+// fields. Strings are a 2-byte length and the bytes, numbers 4-byte little-endian ints, flags one byte.
+// A client may send any number of requests without waiting; responses come back in request order.
+class Protocol
+{
+    public:
+        // Longest request and response bodies accepted
+        static const uint32_t MAX_REQUEST = 64 * 1024;
+        static const uint32_t MAX_RESPONSE = 16 * 1024 * 1024;
+
+        enum Request : uint8_t
+        {
+            PING = 1,
+            FIND_BOOK,          // book ID -> ID, title, author, genre, year, quantity, available
+            BORROW,             // book ID, reader ID
+            RETURN,             // book ID, reader ID
+            IS_BORROWED,        // book ID -> flag
+            READER_LOANS,       // reader ID -> number of books held
+            SEARCH,             // text, limit -> count, then ID and title of each book
+            LIST_BOOKS,         // offset, limit -> count, then book IDs in catalog order
+            LIST_READERS        // offset, limit -> count, then reader IDs
+        };
+
+        // Statuses below BAD_REQUEST are the BatchStatus codes
+        static const uint8_t BAD_REQUEST = 200;
+
+        // Start a frame in a buffer; returns where its length goes, for endFrame
+        static size_t beginFrame(string &buffer)
+        {
+            size_t start = buffer.size();
+            buffer.append(4, '\0');
+            return start;
+        }
+
+        // Fill in the length of the frame started at start
+        static void endFrame(string &buffer, size_t start)
+        {
+            uint32_t length = static_cast<uint32_t>(buffer.size() - start - 4);
+            char bytes[4] = {static_cast<char>(length), static_cast<char>(length >> 8), static_cast<char>(length >> 16), static_cast<char>(length >> 24)};
+            std::memcpy(&buffer[start], bytes, 4);
+        }
+
+        static void putByte(string &buffer, uint8_t value)
+        {
+            buffer.push_back(static_cast<char>(value));
+        }
+
+        static void putInt(string &buffer, int value)
+        {
+            uint32_t bits = static_cast<uint32_t>(value);
+            char bytes[4] = {static_cast<char>(bits), static_cast<char>(bits >> 8), static_cast<char>(bits >> 16), static_cast<char>(bits >> 24)};
+            buffer.append(bytes, 4);
+        }
+
+        // Strings longer than a field can hold are cut short
+        static void putString(string &buffer, const char *text, size_t size)
+        {
+            size = (std::min)(size, static_cast<size_t>(UINT16_MAX));
+            buffer.push_back(static_cast<char>(size));
+            buffer.push_back(static_cast<char>(size >> 8));
+            buffer.append(text, size);
+        }
+
+        static void putString(string &buffer, const string &text)
+        {
+            putString(buffer, text.data(), text.size());
+        }
+
+        // Length of the complete frame at the start of data, 0 if it is not all there yet,
+        // or SIZE_MAX if its body is longer than maxLength
+        static size_t frameLength(const char *data, size_t size, uint32_t maxLength)
+        {
+            if(size < 4)
+            {
+                return 0;
+            }
+
+            const unsigned char *bytes = reinterpret_cast<const unsigned char *>(data);
+            uint32_t length = bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | (static_cast<uint32_t>(bytes[3]) << 24);
+            if(length > maxLength)
+            {
+                return SIZE_MAX;
+            }
+            return size < 4 + static_cast<size_t>(length) ? 0 : 4 + length;
+        }
+
+        // Fields of a frame body, read in order
+        static bool getByte(ByteReader &body, uint8_t &value)
+        {
+            return body.read(value);
+        }
+
+        static bool getInt(ByteReader &body, int &value)
+        {
+            unsigned char bytes[4];
+            if(!body.read(bytes))
+            {
+                return false;
+            }
+            value = static_cast<int>(bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | (static_cast<uint32_t>(bytes[3]) << 24));
+            return true;
+        }
+
+        static bool getString(ByteReader &body, StringRef &text)
+        {
+            unsigned char bytes[2];
+            return body.read(bytes) && body.take(bytes[0] | (bytes[1] << 8), text);
+        }
+
+        static bool getString(ByteReader &body, string &text)
+        {
+            StringRef chars;
+            if(!getString(body, chars))
+            {
+                return false;
+            }
+            text.assign(chars.data(), chars.size());
+            return true;
+        }
+};
+
+const uint32_t Protocol::MAX_REQUEST;
+const uint32_t Protocol::MAX_RESPONSE;
+const uint8_t Protocol::BAD_REQUEST;
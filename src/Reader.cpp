@@ -2,6 +2,7 @@
 #include <iostream>
 #include <vector>
 #include <algorithm>
+#include <cstdint>
 
 using std::string;
 using std::cout;
@@ -11,11 +12,11 @@ class Reader
     private:
         string readerID;
         string name;
-        std::vector<string> borrowedBooks;
+        std::vector<uint32_t> borrowedBooks; // book handles interned by the owning Library
     public:
         Reader(){};
 
-        Reader(const string &readerID, const string &name, const std::vector<string> &borrowedBooks)
+        Reader(const string &readerID, const string &name, const std::vector<uint32_t> &borrowedBooks)
             : readerID(readerID), name(name), borrowedBooks(borrowedBooks)
         {
             cout << "Reader created: " << readerID << '\n';
@@ -31,14 +32,14 @@ class Reader
             this->name = name;
         }
 
-        void appendBorrowedBook(const string &bookID)
+        void appendBorrowedBook(uint32_t bookHandle)
         {
-            borrowedBooks.push_back(bookID);
+            borrowedBooks.push_back(bookHandle);
         }
         
-        bool deleteBorrowedBooks(const string &bookID)
+        bool deleteBorrowedBooks(uint32_t bookHandle)
         {
-            auto it = std::find(borrowedBooks.begin(), borrowedBooks.end(), bookID);
+            auto it = std::find(borrowedBooks.begin(), borrowedBooks.end(), bookHandle);
 
             if(it != borrowedBooks.end())
             {
@@ -49,14 +50,14 @@ class Reader
             return false;
         }
 
-        const std::vector<string> &getBorrowedBooks() const
+        const std::vector<uint32_t> &getBorrowedBooks() const
         {
             return borrowedBooks;
         }
 
-        bool hasBorrowedBook(const string &bookID)
+        bool hasBorrowedBook(uint32_t bookHandle) const
         {
-            return std::find(borrowedBooks.begin(), borrowedBooks.end(), bookID) != borrowedBooks.end();
+            return std::find(borrowedBooks.begin(), borrowedBooks.end(), bookHandle) != borrowedBooks.end();
         }
 
         const int getTotalBorrowedBooks() const
@@ -64,12 +65,12 @@ class Reader
             return borrowedBooks.size();
         }
 
-        string getId() const
+        const string &getId() const
         {
             return readerID;
         }
 
-        string getName() const
+        const string &getName() const
         {
             return name;
         }
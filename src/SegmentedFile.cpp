@@ -0,0 +1,575 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <atomic>
+#include <algorithm>
+#include "FileWriter.cpp"
+#include "MappedFile.cpp"
+#include "Checksum.cpp"
+
+using std::string;
+
+// Groups record handles into fixed-size segments and remembers which segments changed since the last save.
+// A record stays in the segment it was loaded from or first placed in, so an edit only dirties that one segment.
+class SegmentMap
+{
+    public:
+        static const uint32_t CAPACITY = 1024;
+        static const uint32_t NO_SEGMENT = 0xFFFFFFFF;
+
+    private:
+        std::vector<uint32_t> handleSegments;           // handle -> segment
+        std::vector<std::vector<uint32_t>> members;     // segment -> handles
+        std::vector<uint8_t> dirty;
+        size_t dirtyCount = 0;
+
+        void markDirty(uint32_t segment)
+        {
+            if(!dirty[segment])
+            {
+                dirty[segment] = 1;
+                ++dirtyCount;
+            }
+        }
+
+    public:
+        SegmentMap(){};
+
+        // Place a record: into the segment it was loaded from (clean), or for a new record (NO_SEGMENT)
+        // into the last segment with room, which becomes dirty
+        void add(uint32_t handle, uint32_t segment = NO_SEGMENT)
+        {
+            bool isNew = segment == NO_SEGMENT;
+
+            if(isNew)
+            {
+                if(members.empty() || members.back().size() >= CAPACITY)
+                {
+                    members.emplace_back();
+                    dirty.push_back(0);
+                }
+                segment = static_cast<uint32_t>(members.size() - 1);
+            }
+            else if(segment >= members.size())
+            {
+                members.resize(segment + 1);
+                dirty.resize(segment + 1, 0);
+            }
+
+            if(handle >= handleSegments.size())
+            {
+                handleSegments.resize(handle + 1, NO_SEGMENT);
+            }
+            handleSegments[handle] = segment;
+            members[segment].push_back(handle);
+
+            if(isNew)
+            {
+                markDirty(segment);
+            }
+        }
+
+        // Take a deleted record out of its segment
+        void remove(uint32_t handle)
+        {
+            uint32_t segment = handleSegments[handle];
+            std::vector<uint32_t> &handles = members[segment];
+
+            for(size_t i = 0; i < handles.size(); ++i)
+            {
+                if(handles[i] == handle)
+                {
+                    handles[i] = handles.back();
+                    handles.pop_back();
+                    break;
+                }
+            }
+            handleSegments[handle] = NO_SEGMENT;
+            markDirty(segment);
+        }
+
+        // Note that a record changed
+        void touch(uint32_t handle)
+        {
+            if(handle < handleSegments.size() && handleSegments[handle] != NO_SEGMENT)
+            {
+                markDirty(handleSegments[handle]);
+            }
+        }
+
+        size_t size() const
+        {
+            return members.size();
+        }
+
+        // Segment a record is in, or NO_SEGMENT
+        uint32_t segmentOf(uint32_t handle) const
+        {
+            return handle < handleSegments.size() ? handleSegments[handle] : NO_SEGMENT;
+        }
+
+        const std::vector<uint32_t> &membersOf(uint32_t segment) const
+        {
+            return members[segment];
+        }
+
+        const std::vector<uint8_t> &dirtyFlags() const
+        {
+            return dirty;
+        }
+
+        // Mark segments dirty again, e.g. the ones a failed save was meant to write
+        void markDirty(const std::vector<uint8_t> &flags)
+        {
+            for(size_t segment = 0; segment < flags.size() && segment < dirty.size(); ++segment)
+            {
+                if(flags[segment])
+                {
+                    markDirty(static_cast<uint32_t>(segment));
+                }
+            }
+        }
+
+        size_t dirtySegments() const
+        {
+            return dirtyCount;
+        }
+
+        // Forget changes once they are saved
+        void clearDirty()
+        {
+            dirty.assign(dirty.size(), 0);
+            dirtyCount = 0;
+        }
+};
+
+// Where one segment's records are stored
+struct SegmentInfo
+{
+    uint64_t offset;
+    uint32_t length;
+    uint32_t count;
+    uint32_t checksum;
+};
+
+// A file of independently written segments that is saved in place by appending only what changed.
+//
+// Layout: magic "LMSF" and version, then two 32-byte superblock slots, then segment data and segment tables.
+// Version 2 segments hold column-encoded records (see ColumnCodec) and the table starts with 64-bit segment and
+// record counts; version 1 segments hold records in the legacy per-record layout and the table has a 32-bit count.
+// A save appends the dirty segments and a new segment table at the end of the file, syncs, then writes the
+// superblock slot not currently in use (sequence + 1) and syncs again. Loading picks the valid slot with the
+// highest sequence, so a save torn at any point leaves the previous version readable.
+// Once more than half of the file is stale segment versions, or it is in an older version, the next save rewrites
+// it whole (atomically).
+// A save goes in three steps: stage() encodes the changes in memory, write() puts them on disk (and may run on
+// another thread) and commit() switches the file over to them.
+class SegmentedFile
+{
+    public:
+        static const uint32_t MAGIC = 0x46534D4C;   // "LMSF"; as a legacy record count it would exceed any valid file
+        static const uint32_t VERSION = 2;
+
+    private:
+        static const size_t SLOT_SIZE = 32;
+        static const size_t HEADER_SIZE = 8 + 2 * SLOT_SIZE;
+        static const uint64_t MIN_REWRITE_BYTES = 4 << 20;
+
+        struct Superblock
+        {
+            uint64_t sequence = 0;
+            uint64_t tableOffset = 0;
+            uint64_t fileEnd = 0;
+            uint32_t tableChecksum = 0;
+            uint32_t checksum = 0;      // of the fields above
+        };
+
+        string fileName;                // file the state below describes, empty before the first load or save
+        uint32_t fileVersion = VERSION;
+        std::vector<SegmentInfo> table;
+        Superblock current;
+        int currentSlot = 0;
+        uint64_t liveBytes = 0;
+
+        // Save staged in memory and then written, but not yet committed
+        bool rewriting = false;
+        string preparedName;
+        std::vector<SegmentInfo> nextTable;
+        Superblock next;
+        int nextSlot = 0;
+        char stagedHeader[HEADER_SIZE];     // header of a rewritten file
+        ByteWriter stagedBytes;             // changed segments and the new table, written from stagedOffset on
+        uint64_t stagedOffset = 0;
+        std::atomic<uint64_t> stagedLength;
+        std::atomic<uint64_t> writtenBytes; // progress of write(), readable from other threads
+        OutputFile appendFile;
+        AtomicFileWriter rewriteFile;
+
+        static void encodeSuperblock(Superblock &block, char *bytes)
+        {
+            std::memcpy(bytes, &block.sequence, 8);
+            std::memcpy(bytes + 8, &block.tableOffset, 8);
+            std::memcpy(bytes + 16, &block.fileEnd, 8);
+            std::memcpy(bytes + 24, &block.tableChecksum, 4);
+            block.checksum = Checksum::of(bytes, 28);
+            std::memcpy(bytes + 28, &block.checksum, 4);
+        }
+
+        static bool decodeSuperblock(const char *bytes, Superblock &block)
+        {
+            std::memcpy(&block.sequence, bytes, 8);
+            std::memcpy(&block.tableOffset, bytes + 8, 8);
+            std::memcpy(&block.fileEnd, bytes + 16, 8);
+            std::memcpy(&block.tableChecksum, bytes + 24, 4);
+            std::memcpy(&block.checksum, bytes + 28, 4);
+            return block.sequence > 0 && block.checksum == Checksum::of(bytes, 28);
+        }
+
+        static void encodeTable(const std::vector<SegmentInfo> &segments, ByteWriter &bytes)
+        {
+            uint64_t records = 0;
+
+            for(const auto &segment : segments)
+            {
+                records += segment.count;
+            }
+            bytes.write(static_cast<uint64_t>(segments.size()));
+            bytes.write(records);
+            for(const auto &segment : segments)
+            {
+                bytes.write(segment.offset);
+                bytes.write(segment.length);
+                bytes.write(segment.count);
+                bytes.write(segment.checksum);
+            }
+        }
+
+        static uint64_t countLiveBytes(const std::vector<SegmentInfo> &segments, const Superblock &block)
+        {
+            uint64_t bytes = HEADER_SIZE + (block.fileEnd - block.tableOffset);
+
+            for(const auto &segment : segments)
+            {
+                bytes += segment.length;
+            }
+            return bytes;
+        }
+
+        // Encode one segment onto the staged bytes with the caller's encoder and describe where it will sit
+        template<typename Encode>
+        SegmentInfo stageSegment(uint32_t segment, Encode &encode)
+        {
+            SegmentInfo info;
+            size_t start = stagedBytes.size();
+
+            info.count = encode(segment, stagedBytes);
+            info.offset = stagedOffset + start;
+            info.length = static_cast<uint32_t>(stagedBytes.size() - start);
+            info.checksum = Checksum::of(stagedBytes.data() + start, info.length);
+            return info;
+        }
+
+        static const size_t WRITE_CHUNK = 1 << 20;
+
+    public:
+        SegmentedFile(): stagedLength(0), writtenBytes(0) {};
+
+        SegmentedFile(const SegmentedFile &) = delete;
+        SegmentedFile &operator=(const SegmentedFile &) = delete;
+
+        // Check whether file contents are in this format (rather than the legacy flat list)
+        static bool isSegmented(const char *data, size_t size)
+        {
+            uint32_t magic;
+
+            if(size < 4)
+            {
+                return false;
+            }
+            std::memcpy(&magic, data, 4);
+            return magic == MAGIC;
+        }
+
+        // Read the header and segment table of a loaded file; false if the file is damaged or from a newer version
+        bool open(const char *name, const char *data, size_t size)
+        {
+            uint32_t version;
+            Superblock slots[2];
+            bool valid[2];
+
+            if(size < HEADER_SIZE || !isSegmented(data, size))
+            {
+                return false;
+            }
+            std::memcpy(&version, data + 4, 4);
+            if(version < 1 || version > VERSION)
+            {
+                return false;
+            }
+
+            for(int slot = 0; slot < 2; ++slot)
+            {
+                valid[slot] = decodeSuperblock(data + 8 + slot * SLOT_SIZE, slots[slot]) &&
+                              slots[slot].tableOffset >= HEADER_SIZE && slots[slot].tableOffset <= slots[slot].fileEnd &&
+                              slots[slot].fileEnd <= size &&
+                              Checksum::of(data + slots[slot].tableOffset, slots[slot].fileEnd - slots[slot].tableOffset) == slots[slot].tableChecksum;
+            }
+            if(!valid[0] && !valid[1])
+            {
+                return false;
+            }
+            int slot = (valid[0] && (!valid[1] || slots[0].sequence > slots[1].sequence)) ? 0 : 1;
+
+            ByteReader reader(data + slots[slot].tableOffset, slots[slot].fileEnd - slots[slot].tableOffset);
+            uint64_t segmentCount, records = 0, counted = 0;
+            std::vector<SegmentInfo> segments;
+
+            if(version == 1)
+            {
+                uint32_t count32;
+                if(!reader.read(count32))
+                {
+                    return false;
+                }
+                segmentCount = count32;
+            }
+            else if(!reader.read(segmentCount) || !reader.read(records))
+            {
+                return false;
+            }
+            if(segmentCount > reader.remaining() / 20)
+            {
+                return false;
+            }
+            segments.resize(static_cast<size_t>(segmentCount));
+            for(auto &segment : segments)
+            {
+                if(!reader.read(segment.offset) || !reader.read(segment.length) || !reader.read(segment.count) || !reader.read(segment.checksum) ||
+                   segment.offset > slots[slot].tableOffset || segment.length > slots[slot].tableOffset - segment.offset)
+                {
+                    return false;
+                }
+                counted += segment.count;
+            }
+            if(version > 1 && counted != records)
+            {
+                return false;
+            }
+
+            fileName = name;
+            fileVersion = version;
+            table.swap(segments);
+            current = slots[slot];
+            currentSlot = slot;
+            liveBytes = countLiveBytes(table, current);
+            return true;
+        }
+
+        // Format version of the loaded file, which decides how its segments are encoded
+        uint32_t version() const
+        {
+            return fileVersion;
+        }
+
+        size_t segmentCount() const
+        {
+            return table.size();
+        }
+
+        const SegmentInfo &segment(size_t index) const
+        {
+            return table[index];
+        }
+
+        // Total records over all segments
+        uint64_t recordCount() const
+        {
+            uint64_t count = 0;
+
+            for(const auto &segment : table)
+            {
+                count += segment.count;
+            }
+            return count;
+        }
+
+        // Get the bytes of one segment out of the loaded file, checking they are intact
+        bool readSegment(const char *data, size_t index, StringRef &bytes) const
+        {
+            const SegmentInfo &info = table[index];
+
+            bytes = StringRef(data + info.offset, info.length);
+            return Checksum::of(bytes.data(), bytes.size()) == info.checksum;
+        }
+
+        // Identifies the saved version of the file (changes with every save)
+        uint32_t fingerprint() const
+        {
+            return current.checksum;
+        }
+
+        // Whether the next save to a file has to rewrite it whole instead of appending
+        bool willRewrite(const char *name) const
+        {
+            return fileName.empty() || fileName != name || fileVersion != VERSION ||
+                   (current.fileEnd > MIN_REWRITE_BYTES && current.fileEnd > 2 * liveBytes);
+        }
+
+        // Whether appending the next save to a file first changes its length, to cut off a torn earlier attempt past
+        // the end of the current version (or because the file was changed behind our back)
+        bool appendResizes(const char *name) const
+        {
+            return !willRewrite(name) && OutputFile::lengthOf(name) != current.fileEnd;
+        }
+
+        // Encode a new version of the file in memory. Segments marked dirty (and any beyond the current table) are
+        // encoded by encode(segment, ByteWriter&), which returns the number of records written. After this the
+        // caller's data may change freely: write() only needs what was staged.
+        template<typename Encode>
+        void stage(const char *name, size_t segmentCount, const std::vector<uint8_t> &dirty, Encode encode)
+        {
+            rewriting = willRewrite(name);
+            preparedName = name;
+            nextTable.assign(segmentCount, SegmentInfo());
+            next = Superblock();
+            next.sequence = current.sequence + 1;
+            stagedBytes.clear();
+            writtenBytes = 0;
+
+            // A rewrite goes into a whole new file, renamed over the old one on commit;
+            // otherwise changed segments and a new table are appended after the current end of the file
+            stagedOffset = rewriting ? HEADER_SIZE : current.fileEnd;
+            for(uint32_t segment = 0; segment < segmentCount; ++segment)
+            {
+                if(!rewriting && segment < table.size() && !dirty[segment])
+                {
+                    nextTable[segment] = table[segment];
+                    continue;
+                }
+                nextTable[segment] = stageSegment(segment, encode);
+            }
+
+            next.tableOffset = stagedOffset + stagedBytes.size();
+            size_t tableStart = stagedBytes.size();
+            encodeTable(nextTable, stagedBytes);
+            next.tableChecksum = Checksum::of(stagedBytes.data() + tableStart, stagedBytes.size() - tableStart);
+            next.fileEnd = stagedOffset + stagedBytes.size();
+            stagedLength = stagedBytes.size();
+
+            char slotBytes[SLOT_SIZE];
+            nextSlot = rewriting ? 0 : 1 - currentSlot;
+            encodeSuperblock(next, slotBytes);
+            if(rewriting)
+            {
+                std::memset(stagedHeader, 0, HEADER_SIZE);
+                std::memcpy(stagedHeader, &MAGIC, 4);
+                std::memcpy(stagedHeader + 4, &VERSION, 4);
+                std::memcpy(stagedHeader + 8, slotBytes, SLOT_SIZE);
+            }
+        }
+
+        // Bytes the staged version writes, and how many of them are written so far (safe to read while write() runs)
+        uint64_t stagedSize() const
+        {
+            return stagedLength;
+        }
+
+        uint64_t writtenSize() const
+        {
+            return writtenBytes;
+        }
+
+        // Write and sync the staged version without making it visible yet; touches nothing but this object
+        // and the file, so it can run on another thread
+        bool write()
+        {
+            bool written;
+
+            if(rewriting)
+            {
+                if(!rewriteFile.open(preparedName.c_str()))
+                {
+                    return false;
+                }
+                rewriteFile.write(stagedHeader, HEADER_SIZE);
+                for(size_t done = 0; done < stagedBytes.size(); done += WRITE_CHUNK)
+                {
+                    rewriteFile.write(stagedBytes.data() + done, (std::min)(WRITE_CHUNK, stagedBytes.size() - done));
+                    writtenBytes = (std::min)(done + WRITE_CHUNK, stagedBytes.size());
+                }
+                written = rewriteFile.finish();
+                if(!written)
+                {
+                    rewriteFile.discard();
+                }
+            }
+            else
+            {
+                // Anything past the current end is a torn earlier attempt and gets cut off
+                if(!appendFile.open(preparedName.c_str(), false, current.fileEnd))
+                {
+                    return false;
+                }
+                written = true;
+                for(size_t done = 0; done < stagedBytes.size() && written; done += WRITE_CHUNK)
+                {
+                    written = appendFile.write(stagedBytes.data() + done, (std::min)(WRITE_CHUNK, stagedBytes.size() - done));
+                    writtenBytes = (std::min)(done + WRITE_CHUNK, stagedBytes.size());
+                }
+                written = written && appendFile.sync();
+                if(!written)
+                {
+                    appendFile.close();
+                }
+            }
+
+            stagedBytes = ByteWriter();
+            return written;
+        }
+
+        // Fingerprint the staged version will have once committed
+        uint32_t preparedFingerprint() const
+        {
+            return next.checksum;
+        }
+
+        // Make the written version the current one
+        bool commit()
+        {
+            if(rewriting)
+            {
+                if(!rewriteFile.commit())
+                {
+                    return false;
+                }
+            }
+            else
+            {
+                char slotBytes[SLOT_SIZE];
+                encodeSuperblock(next, slotBytes);
+
+                bool written = appendFile.writeAt(8 + nextSlot * SLOT_SIZE, slotBytes, SLOT_SIZE) && appendFile.sync();
+                appendFile.close();
+                if(!written)
+                {
+                    return false;
+                }
+            }
+
+            fileName = preparedName;
+            fileVersion = VERSION;
+            table.swap(nextTable);
+            current = next;
+            currentSlot = nextSlot;
+            liveBytes = countLiveBytes(table, current);
+            return true;
+        }
+};
+
+const uint32_t SegmentMap::CAPACITY;
+const uint32_t SegmentMap::NO_SEGMENT;
+const uint32_t SegmentedFile::MAGIC;
+const uint32_t SegmentedFile::VERSION;
+const size_t SegmentedFile::WRITE_CHUNK;
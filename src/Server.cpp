@@ -0,0 +1,414 @@
+#pragma once
+#ifndef _WIN32
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <utility>
+#include <chrono>
+#include <csignal>
+#include "Library.cpp"
+#include "Protocol.cpp"
+#include "Socket.cpp"
+
+using std::cout;
+using std::string;
+
+// Serves a Library over TCP or a Unix-domain socket in the Protocol format.
+// One thread runs a non-blocking event loop over all clients, so thousands of connections cost a buffer each,
+// not a thread. Every request a client has sent is handled as soon as it arrives and the responses to all of
+// them go out in as few writes as possible. A run of borrows and returns pipelined by one client is applied as
+// one batch, and the batches of every client served in one turn of the loop share one journal sync: responses
+// are only sent once it is done.
+class LibraryServer
+{
+    private:
+        // Stop reading from a client while this much of its output is waiting to be sent
+        static const size_t MAX_PENDING_OUTPUT = 1 << 20;
+        static const size_t READ_LIMIT = 256 * 1024;
+        static const int MAX_LIST = 1000;
+
+        struct Connection
+        {
+            int fd;
+            string input;
+            string output;
+            size_t written = 0;
+            bool reading = true;
+            bool writing = false;
+        };
+
+        Library &library;
+        EventPoller poller;
+        int listener = -1;
+        SocketAddress where;                                       // address listened on
+        std::vector<std::unique_ptr<Connection>> connections;      // by socket
+        std::vector<BatchOperation> circulation;                   // borrows and returns waiting to be applied
+        std::vector<std::pair<int, bool>> served;                  // clients handled in this turn, and if they are still open
+        uint64_t logged = 0;                                       // last journal record of this turn
+        uint64_t clientsServed = 0;
+        uint64_t requestsHandled = 0;
+
+        static volatile std::sig_atomic_t stopRequested;
+
+        static void onSignal(int)
+        {
+            stopRequested = 1;
+        }
+
+        static void putStatus(string &output, uint8_t status)
+        {
+            size_t frame = Protocol::beginFrame(output);
+            Protocol::putByte(output, status);
+            Protocol::endFrame(output, frame);
+        }
+
+        void acceptClients()
+        {
+            for(;;)
+            {
+                int fd = accept(listener, nullptr, nullptr);
+                if(fd < 0)
+                {
+                    if(errno == EMFILE || errno == ENFILE)
+                    {
+                        cout << "Warning: Out of sockets, not accepting more clients for now.\n";
+                    }
+                    return;
+                }
+                if(!Socket::setNonBlocking(fd) || !poller.watch(fd, true, false))
+                {
+                    close(fd);
+                    continue;
+                }
+                Socket::setNoDelay(fd, where);
+
+                if(static_cast<size_t>(fd) >= connections.size())
+                {
+                    connections.resize(fd + 1);
+                }
+                connections[fd].reset(new Connection());
+                connections[fd]->fd = fd;
+                ++clientsServed;
+            }
+        }
+
+        void closeConnection(Connection &connection)
+        {
+            int fd = connection.fd;
+            poller.forget(fd);
+            close(fd);
+            connections[fd].reset();
+        }
+
+        // Apply the borrows and returns collected from a client and answer each in order
+        void flushCirculation(Connection &connection)
+        {
+            if(circulation.empty())
+            {
+                return;
+            }
+
+            BatchReport report;
+            uint64_t batchLogged;
+            library.applyBatch(circulation, BATCH_EACH, report, batchLogged);
+            logged = (std::max)(logged, batchLogged);
+            for(BatchStatus status : report.results)
+            {
+                putStatus(connection.output, static_cast<uint8_t>(status));
+            }
+            circulation.clear();
+        }
+
+        // Answer one request other than a borrow or return; false if it is malformed
+        bool answer(uint8_t request, ByteReader &body, string &output)
+        {
+            string bookID, readerID, text;
+            int offset, limit;
+            size_t frame = Protocol::beginFrame(output);
+
+            switch(request)
+            {
+                case Protocol::PING:
+                    Protocol::putByte(output, BATCH_OK);
+                    break;
+                case Protocol::FIND_BOOK:
+                {
+                    if(!Protocol::getString(body, bookID))
+                    {
+                        return false;
+                    }
+                    std::vector<Book> found = library.findBookByID(bookID);
+                    if(found.empty())
+                    {
+                        Protocol::putByte(output, BATCH_NO_SUCH_BOOK);
+                        break;
+                    }
+                    const Book &book = found[0];
+                    Protocol::putByte(output, BATCH_OK);
+                    Protocol::putString(output, book.getId());
+                    Protocol::putString(output, book.getTitle());
+                    Protocol::putString(output, book.getAuthor());
+                    Protocol::putString(output, book.getGenre());
+                    Protocol::putInt(output, book.getYear());
+                    Protocol::putInt(output, book.getQuantity());
+                    Protocol::putByte(output, book.getIsAvailable() ? 1 : 0);
+                    break;
+                }
+                case Protocol::IS_BORROWED:
+                    if(!Protocol::getString(body, bookID))
+                    {
+                        return false;
+                    }
+                    if(!library.isBookIdExist(bookID))
+                    {
+                        Protocol::putByte(output, BATCH_NO_SUCH_BOOK);
+                        break;
+                    }
+                    Protocol::putByte(output, BATCH_OK);
+                    Protocol::putByte(output, library.isBorrowedBook(bookID) ? 1 : 0);
+                    break;
+                case Protocol::READER_LOANS:
+                    if(!Protocol::getString(body, readerID))
+                    {
+                        return false;
+                    }
+                    if(!library.isReaderIdExist(readerID))
+                    {
+                        Protocol::putByte(output, BATCH_NO_SUCH_READER);
+                        break;
+                    }
+                    Protocol::putByte(output, BATCH_OK);
+                    Protocol::putInt(output, library.getReaderBorrowedBook(readerID));
+                    break;
+                case Protocol::SEARCH:
+                {
+                    if(!Protocol::getString(body, text) || !Protocol::getInt(body, limit) || limit < 0)
+                    {
+                        return false;
+                    }
+                    std::vector<Book> found = library.searchBooks(text, (std::min)(limit, MAX_LIST));
+                    Protocol::putByte(output, BATCH_OK);
+                    Protocol::putInt(output, static_cast<int>(found.size()));
+                    for(const auto &book : found)
+                    {
+                        Protocol::putString(output, book.getId());
+                        Protocol::putString(output, book.getTitle());
+                    }
+                    break;
+                }
+                case Protocol::LIST_BOOKS:
+                {
+                    if(!Protocol::getInt(body, offset) || !Protocol::getInt(body, limit) || offset < 0 || limit < 0)
+                    {
+                        return false;
+                    }
+                    std::vector<Book> found = library.listBooks(offset, (std::min)(limit, MAX_LIST));
+                    Protocol::putByte(output, BATCH_OK);
+                    Protocol::putInt(output, static_cast<int>(found.size()));
+                    for(const auto &book : found)
+                    {
+                        Protocol::putString(output, book.getId());
+                    }
+                    break;
+                }
+                case Protocol::LIST_READERS:
+                {
+                    if(!Protocol::getInt(body, offset) || !Protocol::getInt(body, limit) || offset < 0 || limit < 0)
+                    {
+                        return false;
+                    }
+                    std::vector<string> found = library.listReaderIds(offset, (std::min)(limit, MAX_LIST));
+                    Protocol::putByte(output, BATCH_OK);
+                    Protocol::putInt(output, static_cast<int>(found.size()));
+                    for(const auto &id : found)
+                    {
+                        Protocol::putString(output, id);
+                    }
+                    break;
+                }
+                default:
+                    return false;
+            }
+
+            if(body.remaining() != 0)
+            {
+                return false;
+            }
+            Protocol::endFrame(output, frame);
+            return true;
+        }
+
+        // Handle every complete request a client has sent; false if the client broke the protocol
+        bool handleInput(Connection &connection)
+        {
+            size_t consumed = 0;
+            bool intact = true;
+
+            for(;;)
+            {
+                size_t length = Protocol::frameLength(connection.input.data() + consumed, connection.input.size() - consumed, Protocol::MAX_REQUEST);
+                if(length == 0)
+                {
+                    break;
+                }
+                if(length == SIZE_MAX)
+                {
+                    intact = false;
+                    break;
+                }
+
+                ByteReader body(connection.input.data() + consumed + 4, length - 4);
+                uint8_t request = 0;
+                string bookID, readerID;
+                consumed += length;
+                ++requestsHandled;
+
+                if(Protocol::getByte(body, request) && (request == Protocol::BORROW || request == Protocol::RETURN))
+                {
+                    if(Protocol::getString(body, bookID) && Protocol::getString(body, readerID) && body.remaining() == 0)
+                    {
+                        circulation.push_back(request == Protocol::BORROW ? BatchOperation::borrow(bookID, readerID) : BatchOperation::giveBack(bookID, readerID));
+                        continue;
+                    }
+                    flushCirculation(connection);
+                    putStatus(connection.output, Protocol::BAD_REQUEST);
+                    continue;
+                }
+
+                // Requests are answered in order, so the borrows and returns before this one are applied first
+                flushCirculation(connection);
+                size_t answered = connection.output.size();
+                if(!answer(request, body, connection.output))
+                {
+                    connection.output.resize(answered);
+                    putStatus(connection.output, Protocol::BAD_REQUEST);
+                }
+            }
+            flushCirculation(connection);
+            connection.input.erase(0, consumed);
+            return intact;
+        }
+
+        // Send what a client's output buffer holds and watch the socket for whatever comes next;
+        // false if the connection failed
+        bool flushOutput(Connection &connection)
+        {
+            if(!Socket::sendSome(connection.fd, connection.output, connection.written))
+            {
+                return false;
+            }
+            if(connection.written == connection.output.size())
+            {
+                connection.output.clear();
+                connection.written = 0;
+            }
+
+            bool writing = connection.written < connection.output.size();
+            bool reading = connection.output.size() - connection.written < MAX_PENDING_OUTPUT;
+            if(writing != connection.writing || reading != connection.reading)
+            {
+                connection.writing = writing;
+                connection.reading = reading;
+                return poller.watch(connection.fd, reading, writing);
+            }
+            return true;
+        }
+
+    public:
+        explicit LibraryServer(Library &library): library(library) {};
+
+        LibraryServer(const LibraryServer &) = delete;
+        LibraryServer &operator=(const LibraryServer &) = delete;
+
+        ~LibraryServer()
+        {
+            for(auto &connection : connections)
+            {
+                if(connection)
+                {
+                    close(connection->fd);
+                }
+            }
+            if(listener >= 0)
+            {
+                close(listener);
+            }
+        }
+
+        // Serve clients until interrupted (Ctrl+C or SIGTERM); false if the server cannot start
+        bool run(const string &address)
+        {
+            string error;
+
+            if(!where.parse(address, error) || (listener = Socket::listenOn(where, error)) < 0)
+            {
+                cout << "Error: " << error << '\n';
+                return false;
+            }
+            if(!poller.open() || !poller.watch(listener, true, false))
+            {
+                cout << "Error: Cannot start the event loop.\n";
+                return false;
+            }
+            Socket::raiseFileLimit();
+            std::signal(SIGPIPE, SIG_IGN);
+            std::signal(SIGINT, onSignal);
+            std::signal(SIGTERM, onSignal);
+
+            cout << "Serving the library on " << address << " (Ctrl+C to stop).\n";
+            std::vector<EventPoller::Event> events;
+            while(!stopRequested)
+            {
+                poller.wait(events, 200);
+                served.clear();
+                logged = 0;
+                for(const auto &event : events)
+                {
+                    if(event.fd == listener)
+                    {
+                        acceptClients();
+                        continue;
+                    }
+
+                    Connection *connection = static_cast<size_t>(event.fd) < connections.size() ? connections[event.fd].get() : nullptr;
+                    if(connection == nullptr)
+                    {
+                        continue;
+                    }
+                    bool open = true;
+                    if(event.readable && connection->reading)
+                    {
+                        open = Socket::receiveSome(connection->fd, connection->input, READ_LIMIT);
+                        open = handleInput(*connection) && open;
+                    }
+                    served.push_back(std::make_pair(connection->fd, open));
+                }
+
+                // One sync makes the borrows and returns of every client durable before any of them is answered
+                library.waitDurable(logged);
+                for(const auto &client : served)
+                {
+                    Connection &connection = *connections[client.first];
+                    if(!flushOutput(connection) || !client.second)
+                    {
+                        closeConnection(connection);
+                    }
+                }
+            }
+
+            cout << "Server stopped after " << requestsHandled << " requests from " << clientsServed << " clients.\n";
+            if(where.family() == AF_UNIX)
+            {
+                unlink(address.c_str());
+            }
+            return true;
+        }
+};
+
+volatile std::sig_atomic_t LibraryServer::stopRequested = 0;
+const size_t LibraryServer::MAX_PENDING_OUTPUT;
+const size_t LibraryServer::READ_LIMIT;
+const int LibraryServer::MAX_LIST;
+#endif
@@ -0,0 +1,332 @@
+#pragma once
+#ifndef _WIN32
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cerrno>
+#include <cstdint>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+
+using std::string;
+
+// Where a server listens or a client connects: "host:port", or just "port" for 127.0.0.1,
+// or the path of a Unix-domain socket (anything with a '/')
+class SocketAddress
+{
+    private:
+        sockaddr_storage storage;
+        socklen_t length = 0;
+        string text;
+
+    public:
+        SocketAddress(){};
+
+        // Resolve an address; false with the reason in error if it cannot be
+        bool parse(const string &address, string &error)
+        {
+            std::memset(&storage, 0, sizeof(storage));
+            text = address;
+
+            if(address.find('/') != string::npos)
+            {
+                sockaddr_un *unixAddress = reinterpret_cast<sockaddr_un *>(&storage);
+                if(address.size() >= sizeof(unixAddress->sun_path))
+                {
+                    error = "Socket path is too long: " + address;
+                    return false;
+                }
+                unixAddress->sun_family = AF_UNIX;
+                std::memcpy(unixAddress->sun_path, address.c_str(), address.size() + 1);
+                length = sizeof(sockaddr_un);
+                return true;
+            }
+
+            size_t colon = address.rfind(':');
+            string host = colon == string::npos ? "127.0.0.1" : address.substr(0, colon);
+            string port = colon == string::npos ? address : address.substr(colon + 1);
+            addrinfo hints, *found = nullptr;
+
+            std::memset(&hints, 0, sizeof(hints));
+            hints.ai_family = AF_UNSPEC;
+            hints.ai_socktype = SOCK_STREAM;
+            int result = getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &found);
+            if(result != 0 || found == nullptr)
+            {
+                error = "Cannot resolve " + address + ": " + gai_strerror(result);
+                return false;
+            }
+            std::memcpy(&storage, found->ai_addr, found->ai_addrlen);
+            length = found->ai_addrlen;
+            freeaddrinfo(found);
+            return true;
+        }
+
+        int family() const
+        {
+            return storage.ss_family;
+        }
+
+        const sockaddr *get() const
+        {
+            return reinterpret_cast<const sockaddr *>(&storage);
+        }
+
+        socklen_t size() const
+        {
+            return length;
+        }
+
+        const string &str() const
+        {
+            return text;
+        }
+};
+
+// Socket calls shared by the server and the load generator
+class Socket
+{
+    public:
+        static bool setNonBlocking(int fd)
+        {
+            int flags = fcntl(fd, F_GETFL, 0);
+            return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+        }
+
+        // Turn off Nagle's algorithm on a TCP socket: responses are small and should go out at once
+        static void setNoDelay(int fd, const SocketAddress &address)
+        {
+            if(address.family() != AF_UNIX)
+            {
+                int on = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+            }
+        }
+
+        // Open a non-blocking listening socket; -1 with the reason in error if it cannot be
+        static int listenOn(const SocketAddress &address, string &error)
+        {
+            int fd = socket(address.family(), SOCK_STREAM, 0);
+            int on = 1;
+
+            if(fd < 0)
+            {
+                error = string("Cannot create socket: ") + std::strerror(errno);
+                return -1;
+            }
+            if(address.family() == AF_UNIX)
+            {
+                unlink(address.str().c_str());
+            }
+            else
+            {
+                setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+            }
+            if(bind(fd, address.get(), address.size()) != 0 || listen(fd, SOMAXCONN) != 0 || !setNonBlocking(fd))
+            {
+                error = "Cannot listen on " + address.str() + ": " + std::strerror(errno);
+                close(fd);
+                return -1;
+            }
+            return fd;
+        }
+
+        // Connect to a server, blocking until connected; -1 with the reason in error if it cannot
+        static int connectTo(const SocketAddress &address, string &error)
+        {
+            int fd = socket(address.family(), SOCK_STREAM, 0);
+
+            if(fd < 0 || connect(fd, address.get(), address.size()) != 0)
+            {
+                error = "Cannot connect to " + address.str() + ": " + std::strerror(errno);
+                if(fd >= 0)
+                {
+                    close(fd);
+                }
+                return -1;
+            }
+            setNoDelay(fd, address);
+            return fd;
+        }
+
+        // Allow as many open sockets as the system lets this process have
+        static void raiseFileLimit()
+        {
+            rlimit limit;
+            if(getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+            {
+                limit.rlim_cur = limit.rlim_max;
+                setrlimit(RLIMIT_NOFILE, &limit);
+            }
+        }
+
+        // Write as much of a buffer as the socket takes without blocking; false if the connection failed
+        static bool sendSome(int fd, const string &buffer, size_t &written)
+        {
+            while(written < buffer.size())
+            {
+#ifdef MSG_NOSIGNAL
+                ssize_t sent = send(fd, buffer.data() + written, buffer.size() - written, MSG_NOSIGNAL);
+#else
+                ssize_t sent = send(fd, buffer.data() + written, buffer.size() - written, 0);
+#endif
+                if(sent < 0)
+                {
+                    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+                }
+                written += static_cast<size_t>(sent);
+            }
+            return true;
+        }
+
+        // Read what the socket has without blocking, appending it to a buffer; false once the peer
+        // has closed the connection or it failed
+        static bool receiveSome(int fd, string &buffer, size_t limit)
+        {
+            char chunk[64 * 1024];
+
+            for(size_t total = 0; total < limit; )
+            {
+                ssize_t received = recv(fd, chunk, sizeof(chunk), 0);
+                if(received == 0)
+                {
+                    return false;
+                }
+                if(received < 0)
+                {
+                    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+                }
+                buffer.append(chunk, static_cast<size_t>(received));
+                total += static_cast<size_t>(received);
+            }
+            return true;
+        }
+};
+
+// Readiness notification for many sockets: epoll on Linux, poll elsewhere
+class EventPoller
+{
+    public:
+        struct Event
+        {
+            int fd;
+            bool readable;
+            bool writable;
+        };
+
+    private:
+#ifdef __linux__
+        int epoll = -1;
+        std::vector<epoll_event> ready;
+#else
+        std::vector<pollfd> watched;
+        std::vector<size_t> slots;      // fd -> index in watched, or SIZE_MAX
+#endif
+
+    public:
+        EventPoller(){};
+
+        EventPoller(const EventPoller &) = delete;
+        EventPoller &operator=(const EventPoller &) = delete;
+
+        ~EventPoller()
+        {
+#ifdef __linux__
+            if(epoll >= 0)
+            {
+                close(epoll);
+            }
+#endif
+        }
+
+        bool open()
+        {
+#ifdef __linux__
+            epoll = epoll_create1(0);
+            ready.resize(1024);
+            return epoll >= 0;
+#else
+            return true;
+#endif
+        }
+
+        // Watch a socket for reading and/or writing, or change what it is watched for
+        bool watch(int fd, bool read, bool write)
+        {
+#ifdef __linux__
+            epoll_event event;
+            event.events = (read ? static_cast<uint32_t>(EPOLLIN) : 0u) | (write ? static_cast<uint32_t>(EPOLLOUT) : 0u);
+            event.data.fd = fd;
+            return epoll_ctl(epoll, EPOLL_CTL_MOD, fd, &event) == 0 || (errno == ENOENT && epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &event) == 0);
+#else
+            if(static_cast<size_t>(fd) >= slots.size())
+            {
+                slots.resize(fd + 1, SIZE_MAX);
+            }
+            if(slots[fd] == SIZE_MAX)
+            {
+                slots[fd] = watched.size();
+                watched.push_back(pollfd());
+                watched.back().fd = fd;
+            }
+            watched[slots[fd]].events = static_cast<short>((read ? POLLIN : 0) | (write ? POLLOUT : 0));
+            return true;
+#endif
+        }
+
+        // Stop watching a socket (before closing it)
+        void forget(int fd)
+        {
+#ifdef __linux__
+            epoll_ctl(epoll, EPOLL_CTL_DEL, fd, nullptr);
+#else
+            if(static_cast<size_t>(fd) < slots.size() && slots[fd] != SIZE_MAX)
+            {
+                size_t slot = slots[fd];
+                watched[slot] = watched.back();
+                slots[watched[slot].fd] = slot;
+                watched.pop_back();
+                slots[fd] = SIZE_MAX;
+            }
+#endif
+        }
+
+        // Wait up to timeout milliseconds for sockets to become ready. Errors and hang-ups count as readable,
+        // so they show up as a failed read.
+        void wait(std::vector<Event> &events, int timeout)
+        {
+            events.clear();
+#ifdef __linux__
+            int count = epoll_wait(epoll, ready.data(), static_cast<int>(ready.size()), timeout);
+            for(int i = 0; i < count; ++i)
+            {
+                uint32_t flags = ready[i].events;
+                events.push_back(Event{ready[i].data.fd, (flags & (EPOLLIN | EPOLLERR | EPOLLHUP)) != 0, (flags & EPOLLOUT) != 0});
+            }
+#else
+            if(poll(watched.data(), watched.size(), timeout) <= 0)
+            {
+                return;
+            }
+            for(const auto &entry : watched)
+            {
+                if(entry.revents != 0)
+                {
+                    events.push_back(Event{entry.fd, (entry.revents & (POLLIN | POLLERR | POLLHUP)) != 0, (entry.revents & POLLOUT) != 0});
+                }
+            }
+#endif
+        }
+};
+#endif
@@ -0,0 +1,193 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstring>
+#include <ostream>
+
+using std::string;
+
+// Non-owning view of characters stored elsewhere (an arena block, a mapped file, ...).
+class StringRef
+{
+    private:
+        const char *chars;
+        size_t count;
+
+    public:
+        StringRef(): chars(""), count(0) {};
+
+        StringRef(const char *chars, size_t count): chars(chars), count(count) {};
+
+        const char *data() const
+        {
+            return chars;
+        }
+
+        size_t size() const
+        {
+            return count;
+        }
+
+        size_t length() const
+        {
+            return count;
+        }
+
+        bool empty() const
+        {
+            return count == 0;
+        }
+
+        string str() const
+        {
+            return string(chars, count);
+        }
+
+        operator string() const
+        {
+            return str();
+        }
+
+        bool operator==(const StringRef &other) const
+        {
+            return count == other.count && std::memcmp(chars, other.chars, count) == 0;
+        }
+
+        bool operator==(const string &other) const
+        {
+            return count == other.size() && std::memcmp(chars, other.data(), count) == 0;
+        }
+
+        bool operator==(const char *other) const
+        {
+            return *this == StringRef(other, std::strlen(other));
+        }
+
+        bool operator!=(const string &other) const
+        {
+            return !(*this == other);
+        }
+
+        // Print honouring the stream's width and alignment like std::string does
+        friend std::ostream &operator<<(std::ostream &stream, const StringRef &value)
+        {
+            std::streamsize padding = stream.width() > static_cast<std::streamsize>(value.count) ? stream.width() - value.count : 0;
+            bool leftAligned = (stream.flags() & std::ios::adjustfield) == std::ios::left;
+
+            stream.width(0);
+            if(!leftAligned)
+            {
+                for(std::streamsize i = 0; i < padding; ++i)
+                {
+                    stream.put(stream.fill());
+                }
+            }
+            stream.write(value.chars, value.count);
+            if(leftAligned)
+            {
+                for(std::streamsize i = 0; i < padding; ++i)
+                {
+                    stream.put(stream.fill());
+                }
+            }
+            return stream;
+        }
+};
+
+// Append-only storage for many small strings in a few large blocks.
+// Strings are never freed one by one: overwritten values are only counted as waste, and the whole arena
+// is released at once (a handful of block frees instead of one free per string).
+class StringArena
+{
+    private:
+        static const size_t BLOCK_SIZE = 1 << 20;
+
+        std::vector<std::unique_ptr<char[]>> blocks;
+        char *cursor = nullptr;
+        size_t remaining = 0;
+        size_t allocatedBytes = 0;
+        size_t wastedBytes = 0;
+
+    public:
+        StringArena(){};
+
+        // Get space for a string of a given size; the caller fills it in
+        char *allocate(size_t size)
+        {
+            if(size > remaining)
+            {
+                // Oversized strings get a block of their own so the current block keeps its free space
+                if(size > BLOCK_SIZE / 4)
+                {
+                    blocks.emplace_back(new char[size]);
+                    allocatedBytes += size;
+                    return blocks.back().get();
+                }
+
+                blocks.emplace_back(new char[BLOCK_SIZE]);
+                cursor = blocks.back().get();
+                remaining = BLOCK_SIZE;
+            }
+
+            char *space = cursor;
+            cursor += size;
+            remaining -= size;
+            allocatedBytes += size;
+            return space;
+        }
+
+        // Copy characters into the arena
+        StringRef store(const char *chars, size_t size)
+        {
+            char *space = allocate(size);
+
+            if(size > 0)
+            {
+                std::memcpy(space, chars, size);
+            }
+            return StringRef(space, size);
+        }
+
+        StringRef store(const string &value)
+        {
+            return store(value.data(), value.size());
+        }
+
+        // Note that a stored string is no longer referenced
+        void release(const StringRef &value)
+        {
+            wastedBytes += value.size();
+        }
+
+        // Bytes handed out, including released ones
+        size_t allocated() const
+        {
+            return allocatedBytes;
+        }
+
+        // Bytes handed out and later released
+        size_t wasted() const
+        {
+            return wastedBytes;
+        }
+
+        // Release every string at once
+        void clear()
+        {
+            blocks.clear();
+            cursor = nullptr;
+            remaining = 0;
+            allocatedBytes = 0;
+            wastedBytes = 0;
+        }
+
+        void swap(StringArena &other)
+        {
+            blocks.swap(other.blocks);
+            std::swap(cursor, other.cursor);
+            std::swap(remaining, other.remaining);
+            std::swap(allocatedBytes, other.allocatedBytes);
+            std::swap(wastedBytes, other.wastedBytes);
+        }
+};
\ No newline at end of file
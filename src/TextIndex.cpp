@@ -0,0 +1,496 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <queue>
+#include <algorithm>
+#include <cstdint>
+
+using std::string;
+
+// Full-text index over book titles and authors, keyed by dense document handles.
+// Text is split into case-folded alphanumeric tokens. Every distinct token is a term with a posting list per field
+// of the documents containing it, and the sorted term dictionary doubles as a prefix index. Typo tolerance comes
+// from a trigram index over the term dictionary (not over documents), so fuzzy lookups only look at terms.
+class TextIndex
+{
+    private:
+        static const uint32_t TITLE_FIELD = 0;
+        static const uint32_t AUTHOR_FIELD = 1;
+        static const size_t MAX_EXPANSIONS = 128;
+
+        struct Term
+        {
+            string text;
+            std::vector<uint32_t> postings[2]; // documents, by field
+        };
+
+        // One distinct term and field of a document: (term << 1) | field, and where the document is in the
+        // term's posting list for that field, so removing it does not search that list
+        struct DocumentTerm
+        {
+            uint32_t posting;
+            uint32_t position;
+        };
+
+        typedef std::vector<DocumentTerm> Document;
+
+        // A term matching one query token and how well it matches
+        struct TermMatch
+        {
+            uint32_t term;
+            int weight;
+        };
+
+        std::vector<Term> terms;
+        std::map<string, uint32_t> termIds;
+        std::unordered_map<uint32_t, std::vector<uint32_t>> trigramIndex;
+
+        std::vector<Document> documents;
+
+        // What a document scores for a query token matched by a term of some weight in one of its fields
+        static int impact(int weight, uint32_t field)
+        {
+            return weight * (field == TITLE_FIELD ? 2 : 1) + 1;
+        }
+
+        static size_t postingCount(const Term &term)
+        {
+            return term.postings[TITLE_FIELD].size() + term.postings[AUTHOR_FIELD].size();
+        }
+
+        // Pack three bytes into a trigram key
+        static uint32_t trigramKey(unsigned char a, unsigned char b, unsigned char c)
+        {
+            return (static_cast<uint32_t>(a) << 16) | (static_cast<uint32_t>(b) << 8) | c;
+        }
+
+        // Call a function for every trigram of a term padded with '$' on both sides
+        template<typename F>
+        static void forEachTrigram(const string &text, F function)
+        {
+            string padded = "$" + text + "$";
+
+            for(size_t i = 0; i + 2 < padded.size(); ++i)
+            {
+                function(trigramKey(padded[i], padded[i + 1], padded[i + 2]));
+            }
+        }
+
+        // Edit distance counting insertions, deletions, substitutions and adjacent transpositions,
+        // giving up as soon as it exceeds a bound
+        static int boundedDistance(const string &a, const string &b, int bound)
+        {
+            int lengthDifference = static_cast<int>(a.size()) - static_cast<int>(b.size());
+            if(lengthDifference > bound || -lengthDifference > bound)
+            {
+                return bound + 1;
+            }
+
+            std::vector<int> beforePrevious(b.size() + 1), previous(b.size() + 1), current(b.size() + 1);
+            for(size_t j = 0; j <= b.size(); ++j)
+            {
+                previous[j] = static_cast<int>(j);
+            }
+
+            for(size_t i = 1; i <= a.size(); ++i)
+            {
+                current[0] = static_cast<int>(i);
+                int rowMinimum = current[0];
+
+                for(size_t j = 1; j <= b.size(); ++j)
+                {
+                    int substitution = previous[j - 1] + (a[i - 1] == b[j - 1] ? 0 : 1);
+                    current[j] = (std::min)(substitution, (std::min)(previous[j], current[j - 1]) + 1);
+
+                    if(i > 1 && j > 1 && a[i - 1] == b[j - 2] && a[i - 2] == b[j - 1])
+                    {
+                        current[j] = (std::min)(current[j], beforePrevious[j - 2] + 1);
+                    }
+                    rowMinimum = (std::min)(rowMinimum, current[j]);
+                }
+
+                if(rowMinimum > bound)
+                {
+                    return bound + 1;
+                }
+                std::swap(beforePrevious, previous);
+                std::swap(previous, current);
+            }
+            return previous[b.size()];
+        }
+
+        // Get or create the term ID for a token
+        uint32_t internTerm(const string &token)
+        {
+            auto it = termIds.find(token);
+
+            if(it != termIds.end())
+            {
+                return it->second;
+            }
+
+            uint32_t termID = static_cast<uint32_t>(terms.size());
+            terms.push_back(Term{token, {}});
+            termIds.emplace(token, termID);
+
+            forEachTrigram(token, [this, termID](uint32_t trigram)
+            {
+                std::vector<uint32_t> &bucket = trigramIndex[trigram];
+                if(bucket.empty() || bucket.back() != termID)
+                {
+                    bucket.push_back(termID);
+                }
+            });
+            return termID;
+        }
+
+        // Add the tokens of one field of a document to the index
+        void indexField(uint32_t doc, const string &text, uint32_t field)
+        {
+            for(const auto &token : tokenize(text))
+            {
+                uint32_t posting = (internTerm(token) << 1) | field;
+                Document &docTerms = documents[doc];
+                auto known = std::find_if(docTerms.begin(), docTerms.end(), [posting](const DocumentTerm &entry) { return entry.posting == posting; });
+
+                if(known == docTerms.end())
+                {
+                    std::vector<uint32_t> &termPostings = terms[posting >> 1].postings[field];
+                    docTerms.push_back(DocumentTerm{posting, static_cast<uint32_t>(termPostings.size())});
+                    termPostings.push_back(doc);
+                }
+            }
+        }
+
+        // Find the terms matching one query token: exact, then by prefix, then within a small edit distance
+        std::vector<TermMatch> matchToken(const string &token) const
+        {
+            std::vector<TermMatch> matches;
+
+            auto exact = termIds.find(token);
+            if(exact != termIds.end() && postingCount(terms[exact->second]) != 0)
+            {
+                matches.push_back(TermMatch{exact->second, 4});
+            }
+
+            // Of too many terms with the token as a prefix, the ones in the most documents are kept
+            std::vector<std::pair<size_t, uint32_t>> expansions; // (-postings, term)
+            for(auto it = termIds.upper_bound(token); it != termIds.end() && it->first.compare(0, token.size(), token) == 0; ++it)
+            {
+                size_t postings = postingCount(terms[it->second]);
+                if(postings != 0)
+                {
+                    expansions.push_back(std::make_pair(SIZE_MAX - postings, it->second));
+                }
+            }
+            if(expansions.size() > MAX_EXPANSIONS)
+            {
+                std::partial_sort(expansions.begin(), expansions.begin() + MAX_EXPANSIONS, expansions.end());
+                expansions.resize(MAX_EXPANSIONS);
+            }
+            for(const auto &expansion : expansions)
+            {
+                matches.push_back(TermMatch{expansion.second, 2});
+            }
+
+            // Very short tokens have too few trigrams to tell typos apart from other words
+            if(token.size() < 4)
+            {
+                return matches;
+            }
+
+            int bound = token.size() < 8 ? 1 : 2;
+            int trigramCount = static_cast<int>(token.size());
+            std::unordered_map<uint32_t, int> sharedTrigrams;
+
+            forEachTrigram(token, [this, &sharedTrigrams](uint32_t trigram)
+            {
+                auto bucket = trigramIndex.find(trigram);
+                if(bucket != trigramIndex.end())
+                {
+                    for(uint32_t termID : bucket->second)
+                    {
+                        ++sharedTrigrams[termID];
+                    }
+                }
+            });
+
+            // Each edit destroys at most three trigrams (four for a transposition). The candidates sharing the
+            // most trigrams with the token are the likeliest to be close to it, so they are tried first.
+            std::vector<std::pair<int, uint32_t>> candidates; // (-shared trigrams, term)
+            for(const auto &candidate : sharedTrigrams)
+            {
+                if(candidate.second < trigramCount - 4 * bound)
+                {
+                    continue;
+                }
+
+                const Term &term = terms[candidate.first];
+                if(postingCount(term) != 0 && term.text != token && term.text.compare(0, token.size(), token) != 0)
+                {
+                    candidates.push_back(std::make_pair(-candidate.second, candidate.first));
+                }
+            }
+            std::sort(candidates.begin(), candidates.end());
+
+            size_t fuzzyCount = 0;
+            for(size_t i = 0; i < candidates.size() && fuzzyCount < MAX_EXPANSIONS; ++i)
+            {
+                int distance = boundedDistance(token, terms[candidates[i].second].text, bound);
+                if(distance <= bound)
+                {
+                    matches.push_back(TermMatch{candidates[i].second, distance == 1 ? 1 : 0});
+                    ++fuzzyCount;
+                }
+            }
+            return matches;
+        }
+
+    public:
+        TextIndex(){};
+
+        // Split text into lower-case alphanumeric tokens (bytes outside ASCII are kept as token characters)
+        static std::vector<string> tokenize(const string &text)
+        {
+            std::vector<string> tokens;
+            string token;
+
+            for(char c : text)
+            {
+                unsigned char byte = static_cast<unsigned char>(c);
+
+                if(byte >= 0x80 || (byte >= '0' && byte <= '9') || (byte >= 'a' && byte <= 'z'))
+                {
+                    token += c;
+                }
+                else if(byte >= 'A' && byte <= 'Z')
+                {
+                    token += static_cast<char>(byte - 'A' + 'a');
+                }
+                else if(!token.empty())
+                {
+                    tokens.push_back(token);
+                    token.clear();
+                }
+            }
+
+            if(!token.empty())
+            {
+                tokens.push_back(token);
+            }
+            return tokens;
+        }
+
+        // Index a document's title and author, replacing any previous version
+        void add(uint32_t doc, const string &title, const string &author)
+        {
+            remove(doc);
+
+            if(doc >= documents.size())
+            {
+                documents.resize(doc + 1);
+            }
+
+            indexField(doc, title, TITLE_FIELD);
+            indexField(doc, author, AUTHOR_FIELD);
+        }
+
+        // Remove a document from the index
+        void remove(uint32_t doc)
+        {
+            if(doc >= documents.size())
+            {
+                return;
+            }
+
+            // Each posting is swapped out with the last of its list, whose document is told its new position
+            Document &docTerms = documents[doc];
+            for(const auto &entry : docTerms)
+            {
+                std::vector<uint32_t> &termPostings = terms[entry.posting >> 1].postings[entry.posting & 1];
+                uint32_t moved = termPostings.back();
+
+                termPostings[entry.position] = moved;
+                termPostings.pop_back();
+                if(entry.position == termPostings.size())
+                {
+                    continue;
+                }
+
+                for(auto &movedEntry : documents[moved])
+                {
+                    if(movedEntry.posting == entry.posting)
+                    {
+                        movedEntry.position = entry.position;
+                        break;
+                    }
+                }
+            }
+
+            documents[doc].clear();
+            documents[doc].shrink_to_fit();
+        }
+
+        // Remove every document
+        void clear()
+        {
+            terms.clear();
+            termIds.clear();
+            trigramIndex.clear();
+            documents.clear();
+        }
+
+        // Search for documents matching every query token, best matches first.
+        // Exact token matches rank above prefix matches, which rank above typo matches; title hits count double.
+        // The rarest token's posting lists are read from the highest scoring down, and the search stops once no
+        // document left in them could beat the worst of the best `limit` found so far, so documents tied with that
+        // one may be left out in favour of others.
+        std::vector<uint32_t> search(const string &query, size_t limit) const
+        {
+            std::vector<uint32_t> results;
+            std::vector<string> tokens = tokenize(query);
+
+            if(tokens.empty() || limit == 0)
+            {
+                return results;
+            }
+
+            // Resolve every token to its matching terms and drive the search from the rarest token
+            std::vector<std::vector<TermMatch>> tokenMatches;
+            std::vector<std::pair<size_t, size_t>> order; // (postings touched, token)
+
+            for(const auto &token : tokens)
+            {
+                std::vector<TermMatch> matches = matchToken(token);
+                if(matches.empty())
+                {
+                    return results;
+                }
+
+                size_t postings = 0;
+                for(const auto &match : matches)
+                {
+                    postings += postingCount(terms[match.term]);
+                }
+                order.push_back(std::make_pair(postings, tokenMatches.size()));
+                tokenMatches.push_back(matches);
+            }
+            std::sort(order.begin(), order.end());
+
+            // The other tokens are checked against each document's own (short) term list. Their best possible
+            // scores add up to the most they can give any document.
+            std::vector<std::unordered_map<uint32_t, int>> otherWeights(order.size() - 1);
+            int otherBound = 0;
+            for(size_t i = 1; i < order.size(); ++i)
+            {
+                int tokenBound = 0;
+                for(const auto &match : tokenMatches[order[i].second])
+                {
+                    int &weight = otherWeights[i - 1][match.term];
+                    weight = (std::max)(weight, match.weight);
+                    for(uint32_t field = TITLE_FIELD; field <= AUTHOR_FIELD; ++field)
+                    {
+                        if(!terms[match.term].postings[field].empty())
+                        {
+                            tokenBound = (std::max)(tokenBound, impact(match.weight, field));
+                        }
+                    }
+                }
+                otherBound += tokenBound;
+            }
+
+            // The rarest token's posting lists, highest scoring first. A document is scored where it is first met,
+            // which is its best match for this token.
+            std::vector<std::pair<int, uint32_t>> lists; // (-impact, (term << 1) | field)
+            std::unordered_map<uint32_t, size_t> listOrder;
+            for(const auto &match : tokenMatches[order[0].second])
+            {
+                for(uint32_t field = TITLE_FIELD; field <= AUTHOR_FIELD; ++field)
+                {
+                    if(!terms[match.term].postings[field].empty())
+                    {
+                        lists.push_back(std::make_pair(-impact(match.weight, field), (match.term << 1) | field));
+                    }
+                }
+            }
+            std::sort(lists.begin(), lists.end());
+            for(size_t i = 0; i < lists.size(); ++i)
+            {
+                listOrder.emplace(lists[i].second, i);
+            }
+
+            std::priority_queue<std::pair<int, uint32_t>> best; // (-score, doc), the worst on top
+            std::vector<int> tokenBest(otherWeights.size());
+            for(size_t i = 0; i < lists.size(); ++i)
+            {
+                int bound = -lists[i].first + otherBound;
+                if(best.size() == limit && -best.top().first >= bound)
+                {
+                    break;
+                }
+
+                for(uint32_t doc : terms[lists[i].second >> 1].postings[lists[i].second & 1])
+                {
+                    int score = -lists[i].first;
+                    bool seen = false;
+                    std::fill(tokenBest.begin(), tokenBest.end(), 0);
+
+                    for(const auto &entry : documents[doc])
+                    {
+                        auto earlier = listOrder.find(entry.posting);
+                        if(earlier != listOrder.end() && earlier->second < i)
+                        {
+                            seen = true;
+                            break;
+                        }
+                        for(size_t t = 0; t < otherWeights.size(); ++t)
+                        {
+                            auto weight = otherWeights[t].find(entry.posting >> 1);
+                            if(weight != otherWeights[t].end())
+                            {
+                                tokenBest[t] = (std::max)(tokenBest[t], impact(weight->second, entry.posting & 1));
+                            }
+                        }
+                    }
+                    if(seen || std::find(tokenBest.begin(), tokenBest.end(), 0) != tokenBest.end())
+                    {
+                        continue;
+                    }
+                    for(int tokenScore : tokenBest)
+                    {
+                        score += tokenScore;
+                    }
+
+                    std::pair<int, uint32_t> candidate(-score, doc);
+                    if(best.size() < limit)
+                    {
+                        best.push(candidate);
+                    }
+                    else if(candidate < best.top())
+                    {
+                        best.pop();
+                        best.push(candidate);
+                    }
+                    else
+                    {
+                        continue;
+                    }
+
+                    if(best.size() == limit && -best.top().first >= bound)
+                    {
+                        break;
+                    }
+                }
+            }
+
+            results.resize(best.size());
+            for(size_t i = best.size(); i > 0; --i)
+            {
+                results[i - 1] = best.top().second;
+                best.pop();
+            }
+            return results;
+        }
+};
\ No newline at end of file
@@ -3,7 +3,14 @@
 #include <vector>
 #include <limits>
 #include <ios>
+#include <climits>
+#include <cstdlib>
+#include <future>
+#include <chrono>
 #include "Library.cpp"
+#include "Benchmark.cpp"
+#include "Server.cpp"
+#include "LoadGenerator.cpp"
 #include "Reader.cpp"
 #include "Book.cpp"
 
@@ -14,6 +21,9 @@ using std::getline;
 
 bool running = true;
 
+// Save started from the menu, running on the library's I/O thread
+std::future<PersistReport> pendingSave;
+
 enum Option
 {
     EXIT = 0,
@@ -28,6 +38,8 @@ enum Option
     RETURN_BOOK,
     DISPLAY_READERS,
     SAVE,
+    IMPORT_BOOKS,
+    EXPORT,
     INVALID
 };
 
@@ -44,23 +56,74 @@ void manageBorrowedBookOption(Library &library);
 void returnBookOption(Library &library);
 void displayReaderOption(const Library &library);
 void saveOption(Library &library);
+void reportSave(const PersistReport &report);
+void importBooksOption(Library &library);
+void exportOption(Library &library);
+BookQuery readBookConditions();
 void exitOption(Library &library);
 void handleOption(Option option, Library &library);
 int checkValidInput();
 string getInput(const string &prompt);
 
-int main()
+int main(int argc, char *argv[])
 {
+    // --bench runs the concurrency stress benchmark instead of the menu
+    if(argc > 1 && string(argv[1]) == "--bench")
+    {
+        Benchmark::run();
+        return 0;
+    }
+
+    // --server [address] serves the library over the network instead of the menu;
+    // --loadgen [address] [connections] [depth] [seconds] puts load on a running server
+    if(argc > 1 && (string(argv[1]) == "--server" || string(argv[1]) == "--loadgen"))
+    {
+#ifdef _WIN32
+        cout << "Error: Server mode is not available on Windows.\n";
+        return 1;
+#else
+        string address = argc > 2 ? argv[2] : "7070";
+        if(string(argv[1]) == "--loadgen")
+        {
+            LoadGenerator generator;
+            return generator.run(address, argc > 3 ? std::atoi(argv[3]) : 100, argc > 4 ? std::atoi(argv[4]) : 16, argc > 5 ? std::atoi(argv[5]) : 10) ? 0 : 1;
+        }
+
+        Library library;
+        library.loadFromFile("books.txt", "readers.txt", true);
+        library.openJournal("journal.txt");
+        LibraryServer server(library);
+        bool served = server.run(address);
+        PersistStatus saved = library.saveToFile("books.txt", "readers.txt");
+        return served && saved == PERSIST_OK ? 0 : 1;
+#endif
+    }
+
     Library library;
 
     cout << "Loading library data...\n";
-    library.loadFromFile("books.txt", "readers.txt");
+    // Book records are decoded as they are first used, so the menu is up without decoding the whole catalog
+    library.loadFromFile("books.txt", "readers.txt", true);
+    library.openJournal("journal.txt");
     cout << "Library data loaded.\n";
 
     while(running)
     {
         clearScreen();
 
+        // Report on a save running in the background, or how it ended
+        if(pendingSave.valid())
+        {
+            if(pendingSave.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+            {
+                cout << "Saving in the background: " << library.saveProgress() << "%\n";
+            }
+            else
+            {
+                reportSave(pendingSave.get());
+            }
+        }
+
         cout << "=== LIBRARY MANAGEMENT ===\n";
         cout << Option::ADD_BOOK << ". Add a book\n";
         cout << Option::EDIT_BOOK << ". Edit a book\n";
@@ -73,17 +136,19 @@ int main()
         cout << Option::RETURN_BOOK << ". Return a book\n";
         cout << Option::DISPLAY_READERS << ". Display all readers\n";
         cout << Option::SAVE << ". Save library data\n";
+        cout << Option::IMPORT_BOOKS << ". Import books from a CSV/JSON Lines file\n";
+        cout << Option::EXPORT << ". Export to a CSV/JSON Lines file\n";
         cout << Option::EXIT << ". Exit\n";
 
         int option = checkValidInput();
 
-        if (option >= Option::EXIT && option <= Option::SAVE)
+        if (option >= Option::EXIT && option <= Option::EXPORT)
         {
             handleOption(Option(option), library);
         }
         else
         {
-            cout << "Invalid option! Please choose between " << Option::EXIT << " and " << Option::SAVE << '\n';
+            cout << "Invalid option! Please choose between " << Option::EXIT << " and " << Option::EXPORT << '\n';
             wPause();
         }
     }
@@ -241,6 +306,13 @@ void deleteBookOption(Library &library)
 
     string bookID = getInput("Enter book's ID to delete: ");
 
+    if(library.isBorrowedBook(bookID))
+    {
+        cout << "Error: Book is currently borrowed and cannot be deleted!\n";
+        wPause();
+        return;
+    }
+
     if(!library.deleteBook(bookID))
     {
         cout << "Error: Book ID not found!\n";
@@ -283,12 +355,16 @@ void searchBookOption(Library &library)
     cout << "1. Search by Title\n";
     cout << "2. Search by Genre\n";
     cout << "3. Search by ID\n";
+    cout << "4. Search by keywords (title/author)\n";
+    cout << "5. Search by year range\n";
+    cout << "6. Newest books\n";
+    cout << "7. Advanced search\n";
     
     int option = checkValidInput();
 
-    if(option < 1 || option > 3)
+    if(option < 1 || option > 7)
     {
-        cout << "Invalid option! Please choose between 1 and 3.\n";
+        cout << "Invalid option! Please choose between 1 and 7.\n";
         wPause();
         return;
     }
@@ -322,6 +398,42 @@ void searchBookOption(Library &library)
                 library.displaySearchResult(library.findBookByID(searchBookID));
                 break;
             }
+        case 4:
+            {
+                string searchKeywords;
+                cout << "Enter keywords to search: ";
+                cin.ignore();
+                getline(cin, searchKeywords);
+                library.displaySearchResult(library.searchBooks(searchKeywords));
+                break;
+            }
+        case 5:
+            {
+                int fromYear, toYear;
+                cout << "From year: ";
+                cin >> fromYear;
+                cout << "To year: ";
+                cin >> toYear;
+                cin.ignore();
+                cout << library.countBookByYear(fromYear, toYear) << " books published between " << fromYear << " and " << toYear << '\n';
+                library.displaySearchResult(library.findBookByYear(fromYear, toYear));
+                break;
+            }
+        case 6:
+            {
+                int count;
+                cout << "How many books: ";
+                cin >> count;
+                cin.ignore();
+                library.displaySearchResult(library.findNewestBooks(count < 0 ? 0 : count));
+                break;
+            }
+        case 7:
+            {
+                cin.ignore();
+                library.displaySearchResult(library.findBooks(readBookConditions()));
+                break;
+            }
         
         default:
             cout << "Invalid option!";
@@ -364,7 +476,7 @@ void addReaderOption(Library &library)
     cout << "Name: ";
     getline(cin, readerName);
 
-    std::vector<string> emptyBorrowedBook;
+    std::vector<uint32_t> emptyBorrowedBook;
 
     library.appendReader(Reader(readerID, readerName, emptyBorrowedBook));
     cout << "Reader added!\n";
@@ -427,16 +539,172 @@ void displayReaderOption(const Library &library)
     wPause();
 }
 
-// Save library data to files
+// Save library data to files on the library's I/O thread, so the menu stays usable meanwhile
 void saveOption(Library &library)
 {
     cout << "Saving library data...\n";
-    library.saveToFile("books.txt", "readers.txt");
-    cout << "Library data saved!\n";
+    if(pendingSave.valid() && pendingSave.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+    {
+        cout << "A save is still running (" << library.saveProgress() << "%), try again when it is done.\n";
+    }
+    else
+    {
+        if(pendingSave.valid())
+        {
+            reportSave(pendingSave.get());
+        }
+        pendingSave = library.saveAsync("books.txt", "readers.txt");
+        cout << "Library data is being saved in the background.\n";
+    }
+    wPause();
+}
+
+// Tell how a save from the menu went
+void reportSave(const PersistReport &report)
+{
+    if(report.status == PERSIST_OK)
+    {
+        cout << "Saved " << report.books << " books and " << report.readers << " readers in " << report.seconds << " s.\n";
+    }
+    else
+    {
+        cout << "Error: Saving failed (" << PersistReport::statusText(report.status) << ").\n";
+    }
+}
+
+// Import books in bulk from a CSV or JSON Lines file
+void importBooksOption(Library &library)
+{
+    clearScreen();
+
+    cout << "=== IMPORT BOOKS ===\n";
+    cout << "CSV files start with a header naming the columns id, title, author, genre, year, quantity and optionally available;\n";
+    cout << "JSON Lines files have one object with those keys per line.\n";
+
+    string fileName = getInput("File: ");
+    ImportReport report;
+
+    if(library.importBooks(fileName.c_str(), report) || report.rows > 0)
+    {
+        double seconds = (std::max)(report.seconds, 1e-6);
+        std::ios::fmtflags flags = cout.flags();
+        std::streamsize precision = cout.precision();
+
+        cout << "Imported " << report.imported << " of " << report.rows << " books in " << std::fixed << std::setprecision(2)
+             << report.seconds << "s (" << static_cast<uint64_t>(report.rows / seconds) << " rows/s, "
+             << report.bytes / seconds / (1 << 20) << " MB/s).\n";
+        cout.flags(flags);
+        cout.precision(precision);
+        if(report.rejected > 0)
+        {
+            cout << report.rejected << " rows were rejected";
+            cout << (report.rejected > report.problems.size() ? ", the first of them:\n" : ":\n");
+            for(const auto &problem : report.problems)
+            {
+                cout << "  " << problem << '\n';
+            }
+        }
+    }
+
     wPause();
 }
 
-// Exit the program and save library data
+// Ask for the conditions of an advanced search; fields left empty are ignored, so all empty matches every book
+BookQuery readBookConditions()
+{
+    std::vector<BookQuery> conditions;
+    string field;
+
+    cout << "Leave a field empty to ignore it.\n";
+    cout << "Title: ";
+    getline(cin, field);
+    if(!field.empty())
+    {
+        conditions.push_back(BookQuery::title(field));
+    }
+
+    cout << "Author: ";
+    getline(cin, field);
+    if(!field.empty())
+    {
+        conditions.push_back(BookQuery::author(field));
+    }
+
+    cout << "Genre: ";
+    getline(cin, field);
+    if(!field.empty())
+    {
+        conditions.push_back(BookQuery::genre(field));
+    }
+
+    string fromYear, toYear;
+    cout << "From year: ";
+    getline(cin, fromYear);
+    cout << "To year: ";
+    getline(cin, toYear);
+    if(!fromYear.empty() || !toYear.empty())
+    {
+        conditions.push_back(BookQuery::yearRange(fromYear.empty() ? INT_MIN : std::atoi(fromYear.c_str()),
+                                                  toYear.empty() ? INT_MAX : std::atoi(toYear.c_str())));
+    }
+
+    cout << "Only available books (y/n): ";
+    getline(cin, field);
+    if(field == "y" || field == "Y")
+    {
+        conditions.push_back(BookQuery::available());
+    }
+
+    return BookQuery::all(conditions);
+}
+
+// Export books, readers or loans to a CSV or JSON Lines file
+void exportOption(Library &library)
+{
+    clearScreen();
+
+    cout << "=== EXPORT ===\n";
+    cout << "1. Books\n";
+    cout << "2. Readers\n";
+    cout << "3. Active loans\n";
+
+    int option = checkValidInput();
+
+    if(option < 1 || option > 3)
+    {
+        cout << "Invalid option! Please choose between 1 and 3.\n";
+        wPause();
+        return;
+    }
+
+    string fileName = getInput("File (.csv or .jsonl): ");
+    cin.ignore();
+    ExportReport report;
+    bool exported = false;
+
+    switch(option)
+    {
+        case 1:
+            exported = library.exportBooks(fileName.c_str(), readBookConditions(), report);
+            break;
+        case 2:
+            exported = library.exportReaders(fileName.c_str(), report);
+            break;
+        case 3:
+            cout << "Only loans of books matching these conditions are exported.\n";
+            exported = library.exportLoans(fileName.c_str(), readBookConditions(), report);
+            break;
+    }
+
+    if(exported)
+    {
+        cout << "Exported " << report.records << " records (" << report.bytes << " bytes) in " << report.seconds << "s.\n";
+    }
+    cout << "Press Enter to continue...";
+    cin.get();
+}
+
+// Exit the program and save library data, waiting for the save to finish
 void exitOption(Library &library)
 {
     cout << "Exiting...\n";
@@ -483,6 +751,12 @@ void handleOption(Option option, Library &library)
         case Option::SAVE:
             saveOption(library);
             break;
+        case Option::IMPORT_BOOKS:
+            importBooksOption(library);
+            break;
+        case Option::EXPORT:
+            exportOption(library);
+            break;
         case Option::EXIT:
             exitOption(library);
             break;